@@ -21,6 +21,10 @@ INCLUDEPATH += $$PWD/encoder/ffmpeg/include
 
 win32: LIBS += -L$$PWD/encoder/ffmpeg/bin -lavcodec-55 -lavformat-55 -lavutil-52 -lswscale-2
 
+# PackParser inflates packs with zlib directly
+unix: LIBS += -lz
+win32: INCLUDEPATH += $$[QT_INSTALL_HEADERS]/QtZlib
+
 SOURCES += main.cpp \
     canvasengine.cpp \
     misc/layer.cpp \
@@ -31,12 +35,21 @@ SOURCES += main.cpp \
     brush/binarybrush.cpp \
     brush/brushfeature.cpp \
     brush/brushmanager.cpp \
+    brush/dabcompositor.cpp \
     brush/maskbased.cpp \
     brush/sketchbrush.cpp \
     brush/waterbased.cpp \
     canvasbackend.cpp \
     misc/packparser.cpp \
-    encoder/encoder.cpp
+    misc/strokecodec.cpp \
+    misc/snapshotscheduler.cpp \
+    misc/layerscheduler.cpp \
+    misc/packdecoder.cpp \
+    misc/archiveindex.cpp \
+    misc/cpufeatures.cpp \
+    encoder/encoder.cpp \
+    encoder/yuvconvert.cpp \
+    batchrunner.cpp
 
 HEADERS += \
     canvasengine.h \
@@ -51,13 +64,24 @@ HEADERS += \
     brush/brushfeature.h \
     brush/brushmanager.h \
     brush/brushsettings.h \
+    brush/dabcompositor.h \
     brush/maskbased.h \
     brush/sketchbrush.h \
     brush/waterbased.h \
     canvasbackend.h \
     misc/packparser.h \
+    misc/strokebatch.h \
+    misc/strokecodec.h \
+    misc/snapshotscheduler.h \
+    misc/layerscheduler.h \
+    misc/spscring.h \
+    misc/packdecoder.h \
+    misc/archiveindex.h \
+    misc/cpufeatures.h \
     misc/binary.h \
-    encoder/encoder.h
+    encoder/encoder.h \
+    encoder/yuvconvert.h \
+    batchrunner.h
 
 RESOURCES += \
     res.qrc
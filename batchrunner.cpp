@@ -0,0 +1,293 @@
+#include "batchrunner.h"
+
+#include <QThreadPool>
+#include <QRunnable>
+#include <QEventLoop>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QDir>
+#include <QVector>
+#include <QJsonDocument>
+#include <QJsonArray>
+#include <QJsonObject>
+#include <QJsonValue>
+#include <QThread>
+#include <QThreadStorage>
+#include <QDebug>
+
+#include "canvasengine.h"
+#include "encoder/encoder.h"
+#include "misc/archiveindex.h"
+
+class BatchTask : public QRunnable
+{
+public:
+    BatchTask(const BatchJob &job, BatchResult *result):
+        job_(job),
+        result_(result)
+    {
+    }
+
+    void run()
+    {
+        // every task owns its own slot, no locking needed
+        *result_ = BatchRunner::runJob(job_);
+    }
+private:
+    BatchJob job_;
+    BatchResult *result_;
+};
+
+// every pool thread keeps one encoder and reopens it for each job
+static QThreadStorage<Encoder*> thread_encoder;
+
+BatchRunner::BatchRunner(int maxJobs)
+    :max_jobs_(maxJobs > 0 ? maxJobs : QThread::idealThreadCount()),
+      elapsed_(0)
+{
+}
+
+bool BatchRunner::loadManifest(const QString &fileName)
+{
+    QFile file(fileName);
+    if(!file.open(QIODevice::ReadOnly)){
+        qWarning()<<"cannot open manifest"<<fileName;
+        return false;
+    }
+    QJsonParseError error;
+    QJsonDocument doc = QJsonDocument::fromJson(file.readAll(), &error);
+    if(!doc.isArray()){
+        qWarning()<<"bad manifest"<<fileName<<error.errorString();
+        return false;
+    }
+
+    const QDir base = QFileInfo(fileName).absoluteDir();
+    auto resolve = [&base](const QString &path) -> QString {
+        if(path.isEmpty()){
+            return path;
+        }
+        return base.absoluteFilePath(path);
+    };
+
+    for(const QJsonValue &v: doc.array()){
+        QJsonObject obj = v.toObject();
+        BatchJob job;
+        job.archive = resolve(obj.value("archive").toString());
+        job.canvasSize = QSize(obj.value("width").toInt(2880),
+                               obj.value("height").toInt(1920));
+        job.png = resolve(obj.value("png").toString());
+        job.video = resolve(obj.value("video").toString());
+        job.config = resolve(obj.value("config").toString());
+        if(obj.contains("snapshot")
+                && !SnapshotScheduler::policyFromName(obj.value("snapshot").toString(),
+                                                      &job.snapshotPolicy)){
+            qWarning()<<"unknown snapshot policy"<<obj.value("snapshot").toString();
+        }
+        job.snapshotValue = obj.value("snapshotValue").toInt(20);
+        job.videoSize = obj.value("videoSize").toString();
+        job.until = obj.value("until").toString();
+        job.resume = obj.value("resume").toBool();
+        job.checkpointEvery = obj.value("checkpointEvery").toInt();
+        job.paintThreads = obj.value("paintThreads").toInt(1);
+        job.decodeThreads = obj.value("decodeThreads").toInt(1);
+        if(job.archive.isEmpty()){
+            qWarning()<<"manifest item without archive skipped";
+            continue;
+        }
+        addJob(job);
+    }
+    return true;
+}
+
+void BatchRunner::addJob(const BatchJob &job)
+{
+    jobs_.append(job);
+}
+
+int BatchRunner::maxJobs() const
+{
+    return max_jobs_;
+}
+
+const QList<BatchResult>& BatchRunner::run()
+{
+    QVector<BatchResult> outcomes(jobs_.count());
+    QElapsedTimer timer;
+    timer.start();
+
+    QThreadPool pool;
+    pool.setMaxThreadCount(max_jobs_);
+    for(int i=0;i<jobs_.count();++i){
+        outcomes[i] = BatchResult(jobs_[i]);
+        pool.start(new BatchTask(jobs_[i], &outcomes[i]));
+    }
+    pool.waitForDone();
+
+    elapsed_ = timer.elapsed();
+    results_ = outcomes.toList();
+    return results_;
+}
+
+const QList<BatchResult>& BatchRunner::results() const
+{
+    return results_;
+}
+
+int BatchRunner::failedCount() const
+{
+    int failed = 0;
+    for(const BatchResult &r: results_){
+        if(!r.ok){
+            ++failed;
+        }
+    }
+    return failed;
+}
+
+BatchResult BatchRunner::runJob(const BatchJob &job)
+{
+    BatchResult result(job);
+    QElapsedTimer timer;
+    timer.start();
+
+    QFile input(job.archive);
+    if(!input.open(QIODevice::ReadOnly)){
+        result.error = "cannot open archive";
+        return result;
+    }
+
+    QFile output(job.png);
+    if(!job.png.isEmpty() && !output.open(QIODevice::WriteOnly)){
+        result.error = "cannot open png output";
+        return result;
+    }
+
+    QString config;
+    if(!job.config.isEmpty()){
+        QFile configFile(job.config);
+        if(!configFile.open(QIODevice::ReadOnly)){
+            result.error = "cannot open video encoding config";
+            return result;
+        }
+        config = QString::fromUtf8(configFile.readAll());
+    }
+
+    QSize videoSize = job.canvasSize;
+    if(!job.videoSize.isEmpty()){
+        videoSize = Encoder::sizeFromString(job.videoSize, job.canvasSize);
+        if(videoSize.isEmpty()){
+            result.error = "bad video size";
+            return result;
+        }
+    }
+
+    ArchiveIndex index;
+    const bool seek = !job.until.isEmpty() || job.resume;
+    int untilPack = -1;
+    if(seek){
+        if(index.open(job.archive)){
+            untilPack = job.until.isEmpty() ? index.count() : index.position(job.until);
+        }
+        if(untilPack < 0){
+            result.error = "bad replay position";
+            return result;
+        }
+    }
+
+    Encoder *encoder = nullptr;
+    if(!job.video.isEmpty()){
+        if(!thread_encoder.hasLocalData()){
+            thread_encoder.setLocalData(new Encoder);
+        }
+        encoder = thread_encoder.localData();
+        if(!encoder->open(job.canvasSize, videoSize, job.video, config)){
+            result.error = "cannot open video output";
+            return result;
+        }
+    }
+
+    // engine lives in this pool thread, and this loop drives it
+    QEventLoop loop;
+    CanvasEngine *engine = new CanvasEngine(job.canvasSize);
+    engine->setOffline(true);
+    engine->setPaintThreads(job.paintThreads);
+    engine->setDecodeThreads(job.decodeThreads);
+    if(seek && !engine->replayUntil(index, untilPack)){
+        delete engine;
+        if(encoder){
+            encoder->close();
+        }
+        result.error = "cannot load checkpoint";
+        return result;
+    }
+    if(job.checkpointEvery > 0){
+        engine->setCheckpointing(job.checkpointEvery,
+                                 ArchiveIndex::checkpointDir(job.archive));
+    }
+    engine->setSnapshotPolicy(job.snapshotPolicy, job.snapshotValue);
+    if(output.isOpen()){
+        engine->setOutput(output);
+    }
+    quint64 times = 0;
+    CanvasEngine::connect(engine, &CanvasEngine::canvasUpdated,
+                          [&times]() {
+        times++;
+    });
+    CanvasEngine::connect(engine, &CanvasEngine::snapshotDue,
+                          [engine, encoder]() {
+        if(encoder) {
+            QVector<QRect> changed;
+            const QImage canvas = engine->allCanvas(&changed);
+            encoder->onImage(canvas, changed);
+        }
+    });
+    CanvasEngine::connect(engine, &CanvasEngine::parseEnded,
+                          &loop, &QEventLoop::quit);
+    engine->setInput(input);
+    loop.exec();
+
+    if(encoder){
+        encoder->close();
+    }
+
+    result.blocks = times;
+    result.snapshots = engine->snapshotCount();
+    result.strokes = engine->strokeCount();
+    result.points = engine->pointCount();
+    delete engine;
+
+    result.ok = true;
+    result.elapsed = timer.elapsed();
+    return result;
+}
+
+void BatchRunner::printSummary() const
+{
+    quint64 strokes = 0;
+    quint64 points = 0;
+    for(const BatchResult &r: results_){
+        if(r.ok){
+            qDebug()<<"done"<<r.job.archive
+                   <<r.elapsed<<"ms"
+                  <<r.blocks<<"blocks"
+                 <<r.snapshots<<"snapshots"
+                <<r.strokes<<"strokes"
+               <<r.points<<"points";
+        }else{
+            qDebug()<<"failed"<<r.job.archive<<r.error;
+        }
+        strokes += r.strokes;
+        points += r.points;
+    }
+
+    const qreal seconds = qMax<qint64>(elapsed_, 1) / 1000.0;
+    qDebug()<<"jobs:"<<results_.count()
+           <<"failed:"<<failedCount()
+          <<"threads:"<<max_jobs_
+         <<"wall time:"<<elapsed_<<"ms";
+    qDebug()<<"throughput:"
+           <<(results_.count() - failedCount()) / seconds<<"archives/s"
+          <<strokes / seconds<<"strokes/s"
+         <<points / seconds<<"points/s";
+}
@@ -0,0 +1,93 @@
+#ifndef BATCHRUNNER_H
+#define BATCHRUNNER_H
+
+#include <QList>
+#include <QSize>
+#include <QString>
+#include "misc/snapshotscheduler.h"
+
+struct BatchJob
+{
+    QString archive;
+    QSize canvasSize;
+    QString png;        // optional
+    QString video;      // optional
+    QString config;     // video encoding config file, optional
+    QString videoSize;  // "WxH", canvas size if empty
+    QString until;      // stop position, see ArchiveIndex::position()
+    bool resume;        // go on from latest checkpoint
+    int checkpointEvery;    // blocks, 0 for no checkpoints
+    SnapshotScheduler::Policy snapshotPolicy;
+    qint64 snapshotValue;
+    int paintThreads;   // see CanvasEngine::setPaintThreads()
+    int decodeThreads;  // see CanvasEngine::setDecodeThreads()
+
+    BatchJob():
+        resume(false),
+        checkpointEvery(0),
+        snapshotPolicy(SnapshotScheduler::EVERY_BLOCKS),
+        snapshotValue(20),
+        paintThreads(1),
+        decodeThreads(1)
+    {
+    }
+};
+
+struct BatchResult
+{
+    BatchResult(const BatchJob &j = BatchJob()):
+        job(j),
+        ok(false),
+        elapsed(0),
+        blocks(0),
+        snapshots(0),
+        strokes(0),
+        points(0)
+    {
+    }
+
+    BatchJob job;
+    bool ok;
+    QString error;
+    qint64 elapsed;     // ms
+    quint64 blocks;
+    quint64 snapshots;
+    quint64 strokes;
+    quint64 points;
+};
+
+/*
+ * BatchRunner replays many archives inside one process.
+ * Every job gets its own CanvasEngine (and Encoder), and up to
+ * maxJobs() of them run at the same time on a thread pool.
+ *
+ * Manifest is a json array, each item describes one job:
+ * [{"archive": "a.pack", "width": 2880, "height": 1920,
+ *   "png": "a.png", "video": "a.mkv", "config": "x264.cfg",
+ *   "snapshot": "frames", "snapshotValue": 300, "videoSize": "0x720",
+ *   "paintThreads": 1, "decodeThreads": 1, "until": "50%",
+ *   "resume": false, "checkpointEvery": 0}]
+ * snapshot is blocks, dabs, ms or frames, see SnapshotScheduler.
+ * Relative paths are resolved against the manifest's directory.
+ */
+class BatchRunner
+{
+public:
+    explicit BatchRunner(int maxJobs = 0);
+    bool loadManifest(const QString &fileName);
+    void addJob(const BatchJob &job);
+    int maxJobs() const;
+    const QList<BatchResult>& run();
+    const QList<BatchResult>& results() const;
+    int failedCount() const;
+    void printSummary() const;
+
+    static BatchResult runJob(const BatchJob &job);
+private:
+    int max_jobs_;
+    QList<BatchJob> jobs_;
+    QList<BatchResult> results_;
+    qint64 elapsed_;
+};
+
+#endif // BATCHRUNNER_H
@@ -0,0 +1,49 @@
+#-------------------------------------------------
+#
+# Microbenchmark of every brush's drawPoint and
+# drawLineTo on a standalone Layer
+#
+#-------------------------------------------------
+
+QT       += core gui
+
+TARGET = brushes
+CONFIG   += console
+CONFIG   -= app_bundle
+CONFIG += c++11
+
+TEMPLATE = app
+
+SOURCES += main.cpp \
+    ../../misc/layer.cpp \
+    ../../misc/cpufeatures.cpp \
+    ../../brush/abstractbrush.cpp \
+    ../../brush/basicbrush.cpp \
+    ../../brush/basiceraser.cpp \
+    ../../brush/binarybrush.cpp \
+    ../../brush/brushfeature.cpp \
+    ../../brush/brushmanager.cpp \
+    ../../brush/dabcompositor.cpp \
+    ../../brush/maskbased.cpp \
+    ../../brush/sketchbrush.cpp \
+    ../../brush/waterbased.cpp
+
+HEADERS += \
+    ../../misc/layer.h \
+    ../../misc/cpufeatures.h \
+    ../../misc/singleton.h \
+    ../../misc/call_once.h \
+    ../../brush/abstractbrush.h \
+    ../../brush/basicbrush.h \
+    ../../brush/basiceraser.h \
+    ../../brush/binarybrush.h \
+    ../../brush/brushfeature.h \
+    ../../brush/brushmanager.h \
+    ../../brush/brushsettings.h \
+    ../../brush/dabcompositor.h \
+    ../../brush/maskbased.h \
+    ../../brush/sketchbrush.h \
+    ../../brush/waterbased.h
+
+RESOURCES += \
+    ../../res.qrc
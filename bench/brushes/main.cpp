@@ -0,0 +1,246 @@
+#include <QGuiApplication>
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QVector>
+#include <QPoint>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonArray>
+#include <QtMath>
+#include <cstdio>
+#include <random>
+
+#include "../../misc/singleton.h"
+#include "../../misc/layer.h"
+#include "../../brush/brushmanager.h"
+#include "../../brush/dabcompositor.h"
+#include "../../brush/basicbrush.h"
+#include "../../brush/binarybrush.h"
+#include "../../brush/sketchbrush.h"
+#include "../../brush/basiceraser.h"
+#include "../../brush/maskbased.h"
+#include "../../brush/waterbased.h"
+
+static const QSize layer_size(2048, 2048);
+static const int POINTS = 2000;
+static const int SEGMENTS = 500;
+
+struct Result
+{
+    QString brush;
+    const char *test;
+    int width;
+    qreal pressure;
+    int segment;        // 0 for points
+    int calls;
+    quint64 dabs;       // dabs and painter calls, as layer counts them
+    qint64 ns;
+};
+
+// returns how many brushes were made, names must not collide
+static int register_brushes(BrushManager &manager)
+{
+    const BrushPointer brushes[] = {
+        BrushPointer(new BasicBrush),
+        BrushPointer(new BinaryBrush),
+        BrushPointer(new SketchBrush),
+        BrushPointer(new BasicEraser),
+        BrushPointer(new MaskBased),
+        BrushPointer(new WaterBased)
+    };
+    for(const BrushPointer &b: brushes){
+        b->setSettings(b->defaultSettings());
+        manager.addBrush(b);
+    }
+    return sizeof(brushes) / sizeof(brushes[0]);
+}
+
+static QVector<QPoint> make_points(int count, std::mt19937 &rng)
+{
+    QVector<QPoint> points;
+    for(int i=0;i<count;++i){
+        points.append(QPoint(rng() % layer_size.width(),
+                             rng() % layer_size.height()));
+    }
+    return points;
+}
+
+// a walk of count segments of length each, bouncing off layer's edges
+static QVector<QPoint> make_path(int count, int length, std::mt19937 &rng)
+{
+    QVector<QPoint> path;
+    qreal x = layer_size.width() / 2;
+    qreal y = layer_size.height() / 2;
+    path.append(QPoint(qRound(x), qRound(y)));
+    for(int i=0;i<count;++i){
+        const qreal angle = (rng() % 6283) / 1000.0;
+        qreal nx = x + length * qCos(angle);
+        qreal ny = y + length * qSin(angle);
+        if(nx < 0 || nx >= layer_size.width()){
+            nx = x - length * qCos(angle);
+        }
+        if(ny < 0 || ny >= layer_size.height()){
+            ny = y - length * qSin(angle);
+        }
+        x = nx;
+        y = ny;
+        path.append(QPoint(qRound(x), qRound(y)));
+    }
+    return path;
+}
+
+static BrushPointer fresh_brush(BrushManager &manager, const QString &name,
+                                const LayerPointer &layer, int width)
+{
+    BrushPointer brush = manager.makeBrush(name);
+    brush->setSurface(layer);
+    brush->setWidth(width);
+    brush->setColor(QColor(200, 30, 60));
+    return brush;
+}
+
+static Result run_points(BrushManager &manager, const QString &name, int width,
+                         qreal pressure, const QVector<QPoint> &points)
+{
+    LayerPointer layer(new Layer("bench", layer_size));
+    BrushPointer brush = fresh_brush(manager, name, layer, width);
+    QElapsedTimer timer;
+    timer.start();
+    for(const QPoint &p: points){
+        brush->drawPoint(p, pressure);
+    }
+    const qint64 ns = timer.nsecsElapsed();
+    return Result{name, "point", width, pressure, 0, points.count(),
+                layer->takeDabCount(), ns};
+}
+
+static Result run_segments(BrushManager &manager, const QString &name, int width,
+                           qreal pressure, int length, const QVector<QPoint> &path)
+{
+    LayerPointer layer(new Layer("bench", layer_size));
+    BrushPointer brush = fresh_brush(manager, name, layer, width);
+    // stroke's first dab is not a segment's
+    brush->drawPoint(path.first(), pressure);
+    layer->takeDabCount();
+    QElapsedTimer timer;
+    timer.start();
+    for(int i=1;i<path.count();++i){
+        brush->drawLineTo(path[i], pressure);
+    }
+    const qint64 ns = timer.nsecsElapsed();
+    return Result{name, "segment", width, pressure, length, path.count() - 1,
+                layer->takeDabCount(), ns};
+}
+
+static QJsonObject to_json(const Result &r)
+{
+    QJsonObject obj;
+    obj.insert("brush", r.brush);
+    obj.insert("test", QString(r.test));
+    obj.insert("width", r.width);
+    obj.insert("pressure", r.pressure);
+    obj.insert("segment", r.segment);
+    obj.insert("calls", r.calls);
+    obj.insert("dabs", double(r.dabs));
+    obj.insert("ns", double(r.ns));
+    obj.insert("nsPerDab", r.dabs ? double(r.ns) / r.dabs : 0.0);
+    obj.insert("nsPerCall", double(r.ns) / qMax(r.calls, 1));
+    return obj;
+}
+
+int main(int argc, char *argv[])
+{
+    QGuiApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Cost of every brush's drawPoint and drawLineTo.");
+    parser.addHelpOption();
+    parser.addPositionalArgument("brush", "Only run brushes with these names.",
+                                 "[brush...]");
+    QCommandLineOption jsonOption("json",
+                                  "Also write results to <file> as json.",
+                                  "file");
+    parser.addOption(jsonOption);
+    parser.process(app);
+
+    const int widths[] = {1, 2, 5, 10, 20, 50, 100};
+    const qreal pressures[] = {0.2, 0.6, 1.0};
+    const int lengths[] = {1, 8, 32, 128};
+
+    BrushManager &manager = Singleton<BrushManager>::instance();
+    const int registered = register_brushes(manager);
+    if(manager.allBrushes().count() != registered){
+        printf("%d brushes made, %d registered\n", registered,
+               manager.allBrushes().count());
+        return 1;
+    }
+    QStringList only;
+    for(const QString &name: parser.positionalArguments()){
+        only.append(name.trimmed().toLower());
+    }
+
+    QList<Result> results;
+    // a brush that never reaches the layer would only show as fast
+    QStringList silent;
+    printf("dab kernel: %s\n", DabCompositor::kernelName(DabCompositor::kernel()));
+    printf("%14s %8s %6s %9s %8s %10s %12s %12s\n", "brush", "test", "width",
+           "pressure", "segment", "dabs", "ns/dab", "ns/call");
+    for(const BrushPointer &registered: manager.allBrushes()){
+        const QString name = registered->name().trimmed().toLower();
+        if(!only.isEmpty() && !only.contains(name)){
+            continue;
+        }
+        quint64 dabs = 0;
+        for(int width: widths){
+            for(qreal pressure: pressures){
+                // same positions for every brush, so they compare
+                std::mt19937 rng(width);
+                QList<Result> runs;
+                runs.append(run_points(manager, name, width, pressure,
+                                       make_points(POINTS, rng)));
+                for(int length: lengths){
+                    runs.append(run_segments(manager, name, width, pressure, length,
+                                             make_path(SEGMENTS, length, rng)));
+                }
+                for(const Result &r: runs){
+                    printf("%14s %8s %6d %9.1f %8d %10llu %12.1f %12.1f\n",
+                           qPrintable(r.brush), r.test, r.width, r.pressure,
+                           r.segment, (unsigned long long)r.dabs,
+                           r.dabs ? double(r.ns) / r.dabs : 0.0,
+                           double(r.ns) / qMax(r.calls, 1));
+                    dabs += r.dabs;
+                }
+                results += runs;
+            }
+        }
+        if(!dabs){
+            silent.append(name);
+        }
+    }
+
+    if(parser.isSet(jsonOption)){
+        QJsonArray array;
+        for(const Result &r: results){
+            array.append(to_json(r));
+        }
+        QJsonObject doc;
+        doc.insert("kernel", QString(DabCompositor::kernelName(DabCompositor::kernel())));
+        doc.insert("qt", QString(qVersion()));
+        doc.insert("results", array);
+        QFile file(parser.value(jsonOption));
+        if(!file.open(QIODevice::WriteOnly)){
+            printf("cannot open %s\n", qPrintable(parser.value(jsonOption)));
+            return 1;
+        }
+        if(file.write(QJsonDocument(doc).toJson()) < 0){
+            printf("cannot write %s\n", qPrintable(parser.value(jsonOption)));
+            return 1;
+        }
+    }
+    if(!silent.isEmpty()){
+        printf("no dabs counted for %s\n", qPrintable(silent.join(", ")));
+        return 1;
+    }
+    return 0;
+}
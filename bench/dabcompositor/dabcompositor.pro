@@ -0,0 +1,22 @@
+#-------------------------------------------------
+#
+# Microbenchmark of DabCompositor against QPainter
+#
+#-------------------------------------------------
+
+QT       += core gui
+
+TARGET = dabcompositor
+CONFIG   += console
+CONFIG   -= app_bundle
+CONFIG += c++11
+
+TEMPLATE = app
+
+SOURCES += main.cpp \
+    ../../brush/dabcompositor.cpp \
+    ../../misc/cpufeatures.cpp
+
+HEADERS += \
+    ../../brush/dabcompositor.h \
+    ../../misc/cpufeatures.h
@@ -0,0 +1,94 @@
+#include <QGuiApplication>
+#include <QImage>
+#include <QPainter>
+#include <QRadialGradient>
+#include <QElapsedTimer>
+#include <QVector>
+#include <QPoint>
+#include <cstdio>
+#include <random>
+
+#include "../../brush/dabcompositor.h"
+
+static QImage make_dab(int width)
+{
+    QImage dab(width, width, QImage::Format_ARGB32_Premultiplied);
+    dab.fill(Qt::transparent);
+    QPainter painter(&dab);
+    QRadialGradient gradient(width/2.0, width/2.0, width/2.0);
+    gradient.setColorAt(0, QColor(200, 30, 60, 255));
+    gradient.setColorAt(0.5, QColor(200, 30, 60, 120));
+    gradient.setColorAt(1, Qt::transparent);
+    painter.setPen(Qt::NoPen);
+    painter.setBrush(gradient);
+    painter.drawEllipse(0, 0, width, width);
+    return dab;
+}
+
+static QImage make_layer()
+{
+    QImage layer(1920, 1080, QImage::Format_ARGB32_Premultiplied);
+    layer.fill(Qt::transparent);
+    QPainter painter(&layer);
+    painter.fillRect(0, 0, 960, 1080, QColor(0, 0, 255, 128));
+    return layer;
+}
+
+int main(int argc, char *argv[])
+{
+    QGuiApplication app(argc, argv);
+
+    const int dabs = 20000;
+    const int widths[] = {4, 16, 32, 64, 100};
+    const DabCompositor::Kernel kernels[] = {
+        DabCompositor::SCALAR,
+        DabCompositor::SSE2,
+        DabCompositor::AVX2
+    };
+    const DabCompositor::Kernel selected = DabCompositor::kernel();
+    bool failed = false;
+
+    printf("selected kernel: %s\n", DabCompositor::kernelName(selected));
+    printf("%8s %10s %12s\n", "width", "path", "ns/dab");
+    for(int width: widths){
+        const QImage dab = make_dab(width);
+        QVector<QPoint> positions;
+        std::mt19937 rng(width);
+        for(int i=0;i<dabs;++i){
+            positions.append(QPoint(int(rng() % 2000) - 40,
+                                    int(rng() % 1160) - 40));
+        }
+
+        QImage reference = make_layer();
+        QElapsedTimer timer;
+        timer.start();
+        {
+            QPainter painter(&reference);
+            painter.setRenderHint(QPainter::Antialiasing);
+            for(const QPoint &p: positions){
+                painter.drawImage(p, dab);
+            }
+        }
+        printf("%8d %10s %12.1f\n", width, "qpainter",
+               timer.nsecsElapsed() / double(dabs));
+
+        for(DabCompositor::Kernel k: kernels){
+            if(!DabCompositor::setKernel(k)){
+                continue;
+            }
+            QImage layer = make_layer();
+            timer.restart();
+            for(const QPoint &p: positions){
+                DabCompositor::blend(&layer, dab, p);
+            }
+            const qint64 elapsed = timer.nsecsElapsed();
+            const bool mismatch = layer != reference;
+            failed = failed || mismatch;
+            printf("%8d %10s %12.1f%s\n", width, DabCompositor::kernelName(k),
+                   elapsed / double(dabs),
+                   mismatch ? "  MISMATCH" : "");
+        }
+        DabCompositor::setKernel(selected);
+    }
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,489 @@
+#include <QGuiApplication>
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QBuffer>
+#include <QFile>
+#include <QDir>
+#include <QTemporaryDir>
+#include <QThread>
+#include <QImage>
+#include <QVector>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonArray>
+#include <QtMath>
+#include <cstdio>
+#include <random>
+
+#ifdef Q_OS_UNIX
+#include <sys/resource.h>
+#endif
+#include <cstdlib>
+#include <cstring>
+
+#include "../../canvasengine.h"
+#include "../../misc/layer.h"
+#include "../../misc/packparser.h"
+#include "../../misc/strokecodec.h"
+#include "../../misc/spscring.h"
+#include "../../encoder/encoder.h"
+
+enum Pressure {
+    CONSTANT = 0,
+    RAMP,       // tapers in and out like a pen stroke
+    JITTER
+};
+
+// Every archive is generated from its name alone, so numbers of
+// different builds are measured on the very same bytes.
+struct Scenario
+{
+    const char *name;
+    int width;
+    int height;
+    int layers;
+    const char *brushes;    // comma separated, one picked per stroke
+    int minWidth;
+    int maxWidth;
+    Pressure pressure;
+    int spacing;            // pixels between points
+    int strokes;
+    int points;             // per stroke
+    bool records;           // binary stroke records instead of json
+    bool compress;
+};
+
+static const Scenario scenarios[] = {
+    {"thin-720p", 1280, 720, 1, "basicbrush",
+     4, 4, CONSTANT, 2, 2000, 64, false, true},
+    {"wide-ramp", 2880, 1920, 2, "basicbrush",
+     60, 120, RAMP, 6, 600, 96, false, true},
+    {"mixed-brushes", 2880, 1920, 10,
+     "basicbrush,binarybrush,sketchbrush,basiceraser,maskbased",
+     4, 80, JITTER, 3, 1500, 64, false, true},
+    {"dense-records", 2880, 1920, 4, "basicbrush,maskbased",
+     12, 24, JITTER, 1, 800, 512, true, false},
+    {"sparse-records", 2880, 1920, 4, "basicbrush,binarybrush",
+     8, 32, RAMP, 12, 2000, 32, true, true},
+    {"4k-layers", 3840, 2160, 10, "basicbrush,maskbased",
+     8, 48, RAMP, 3, 1500, 80, true, true}
+};
+
+// composite every this many strokes, like snapshots of a replay
+static const int COMPOSITE_EVERY = 20;
+// composites kept for encode stage, they take a whole canvas each
+static const int ENCODE_FRAMES = 8;
+static const int RING_SIZE = 1024;
+static const int POP_SIZE = 64;
+
+struct StageResult
+{
+    StageResult():
+        ns(0),
+        packs(0),
+        points(0),
+        dabs(0),
+        frames(0),
+        rss(0),
+        rssGrowth(0)
+    {
+    }
+
+    qint64 ns;
+    quint64 packs;
+    quint64 points;
+    quint64 dabs;
+    quint64 frames;
+    long rss;       // peak while the stage ran, KiB
+    long rssGrowth; // how far that peak went above rss at stage start
+};
+
+// Peak RSS of one stage. On Linux the high-water mark is reset when a
+// stage starts, see proc(5) clear_refs, and VmHWM read when it ends.
+// Elsewhere the process peak can only grow, so a stage that stays below
+// an earlier one shows no growth.
+class RssProbe
+{
+public:
+    RssProbe():
+        base_(0)
+    {
+    }
+    void start()
+    {
+#ifdef Q_OS_LINUX
+        FILE *f = fopen("/proc/self/clear_refs", "w");
+        if(f){
+            fputs("5", f);
+            fclose(f);
+        }
+        base_ = status_kib("VmRSS:");
+#else
+        base_ = process_peak();
+#endif
+    }
+    // peak since start(), recorded into r if it's higher
+    void stop(StageResult *r) const
+    {
+#ifdef Q_OS_LINUX
+        const long peak = status_kib("VmHWM:");
+#else
+        const long peak = process_peak();
+#endif
+        r->rss = qMax(r->rss, peak);
+        r->rssGrowth = qMax(r->rssGrowth, peak - base_);
+    }
+private:
+#ifdef Q_OS_LINUX
+    static long status_kib(const char *key)
+    {
+        long kib = 0;
+        FILE *f = fopen("/proc/self/status", "r");
+        if(!f){
+            return 0;
+        }
+        char line[256];
+        const size_t len = strlen(key);
+        while(fgets(line, sizeof(line), f)){
+            if(!strncmp(line, key, len)){
+                kib = atol(line + len);
+                break;
+            }
+        }
+        fclose(f);
+        return kib;
+    }
+#else
+    static long process_peak()
+    {
+#ifdef Q_OS_UNIX
+        struct rusage usage;
+        if(getrusage(RUSAGE_SELF, &usage) == 0){
+#ifdef Q_OS_MAC
+            return usage.ru_maxrss / 1024;
+#else
+            return usage.ru_maxrss;
+#endif
+        }
+#endif
+        return 0;
+    }
+#endif
+    long base_;
+};
+
+static quint32 name_seed(const char *name)
+{
+    // qHash() is seeded per process, this is not
+    quint32 seed = 2166136261u;
+    for(const char *c = name; *c; ++c){
+        seed = (seed ^ quint8(*c)) * 16777619u;
+    }
+    return seed;
+}
+
+static qreal pressure_at(Pressure profile, int i, int count, std::mt19937 &rng)
+{
+    switch(profile){
+    case RAMP:
+        return qMax(0.05, qSin(M_PI * (i + 0.5) / count));
+    case JITTER:
+        return 0.3 + 0.7 * (rng() % 1000) / 999.0;
+    default:
+        return 1.0;
+    }
+}
+
+static QJsonObject to_block(const StrokeBatch &stroke)
+{
+    QJsonArray points;
+    for(const StrokePoint &p: stroke.points){
+        QJsonObject point;
+        point.insert("x", p.x);
+        point.insert("y", p.y);
+        point.insert("pressure", p.pressure);
+        points.append(point);
+    }
+    QJsonObject block;
+    block.insert("action", QString("block"));
+    block.insert("clientid", stroke.clientid);
+    block.insert("layer", stroke.layer);
+    block.insert("brush", QJsonObject::fromVariantMap(stroke.brush));
+    block.insert("block", points);
+    return block;
+}
+
+static QByteArray make_archive(const Scenario &s)
+{
+    std::mt19937 rng(name_seed(s.name));
+    const QStringList brushes = QString(s.brushes).split(',');
+    PackParser parser;
+    QByteArray archive;
+    for(int i=0;i<s.strokes;++i){
+        StrokeBatch stroke;
+        stroke.clientid = QString("client%1").arg(i % 4);
+        stroke.layer = QString::number(rng() % s.layers);
+
+        QVariantMap color;
+        color.insert("red", int(rng() % 256));
+        color.insert("green", int(rng() % 256));
+        color.insert("blue", int(rng() % 256));
+        stroke.brush.insert("name", brushes[rng() % brushes.count()]);
+        stroke.brush.insert("width", s.minWidth
+                            + int(rng() % (s.maxWidth - s.minWidth + 1)));
+        stroke.brush.insert("thickness", 20 + int(rng() % 81));
+        stroke.brush.insert("hardness", 20 + int(rng() % 81));
+        stroke.brush.insert("color", color);
+
+        // a wandering walk, turning a little at every point
+        qreal x = rng() % s.width;
+        qreal y = rng() % s.height;
+        qreal angle = (rng() % 6283) / 1000.0;
+        for(int j=0;j<s.points;++j){
+            StrokePoint p;
+            p.x = qRound(x);
+            p.y = qRound(y);
+            p.pressure = pressure_at(s.pressure, j, s.points, rng);
+            stroke.points.append(p);
+            angle += ((int(rng() % 201) - 100) / 1000.0);
+            x = qBound(0.0, x + s.spacing * qCos(angle), s.width - 1.0);
+            y = qBound(0.0, y + s.spacing * qSin(angle), s.height - 1.0);
+        }
+
+        const QByteArray data = s.records
+                ? StrokeCodec::encode(stroke)
+                : QJsonDocument(to_block(stroke)).toJson(QJsonDocument::Compact);
+        archive += parser.packRaw(parser.assamblePack(s.compress,
+                                                      PackParser::DATA,
+                                                      data));
+    }
+    return archive;
+}
+
+class RingProducer : public QThread
+{
+public:
+    RingProducer(SpscRing<StrokeBatch> *ring, const QVector<StrokeBatch> &strokes):
+        ring_(ring),
+        strokes_(strokes)
+    {
+    }
+protected:
+    void run()
+    {
+        for(const StrokeBatch &s: strokes_){
+            while(!ring_->push(s)){
+                QThread::yieldCurrentThread();
+            }
+        }
+    }
+private:
+    SpscRing<StrokeBatch> *ring_;
+    const QVector<StrokeBatch> &strokes_;
+};
+
+static quint64 count_points(const QVector<StrokeBatch> &strokes)
+{
+    quint64 points = 0;
+    for(const StrokeBatch &s: strokes){
+        points += s.points.count();
+    }
+    return points;
+}
+
+static StageResult decode_stage(const QByteArray &archive, QVector<StrokeBatch> *strokes)
+{
+    StageResult r;
+    RssProbe probe;
+    probe.start();
+    QByteArray bytes = archive;
+    QBuffer buffer(&bytes);
+    buffer.open(QIODevice::ReadOnly);
+    PackParser parser;
+    PackParser::ParserResult pack;
+    QElapsedTimer timer;
+    timer.start();
+    while(parser.readPack(buffer, pack)){
+        ++r.packs;
+        StrokeBatch stroke;
+        if(pack.pack_type == PackParser::DATA
+                && StrokeCodec::fromData(pack.pack_data, stroke)){
+            strokes->append(stroke);
+        }
+    }
+    r.ns = timer.nsecsElapsed();
+    r.points = count_points(*strokes);
+    probe.stop(&r);
+    return r;
+}
+
+// parser thread hands strokes to painting thread
+static StageResult dispatch_stage(const QVector<StrokeBatch> &strokes)
+{
+    StageResult r;
+    RssProbe probe;
+    probe.start();
+    SpscRing<StrokeBatch> ring(RING_SIZE);
+    QVector<StrokeBatch> popped(POP_SIZE);
+    RingProducer producer(&ring, strokes);
+    QElapsedTimer timer;
+    timer.start();
+    producer.start();
+    while(r.packs < quint64(strokes.count())){
+        const int n = ring.pop(popped.data(), POP_SIZE);
+        if(!n){
+            QThread::yieldCurrentThread();
+            continue;
+        }
+        for(int i=0;i<n;++i){
+            r.points += popped[i].points.count();
+        }
+        r.packs += n;
+    }
+    r.ns = timer.nsecsElapsed();
+    producer.wait();
+    probe.stop(&r);
+    return r;
+}
+
+static void paint_stages(const Scenario &s, const QVector<StrokeBatch> &strokes,
+                         int paintThreads, StageResult *paint,
+                         StageResult *composite, QVector<QImage> *frames)
+{
+    // paint and composite take turns, each turn is probed on its own
+    RssProbe probe;
+    probe.start();
+    CanvasEngine engine(QSize(s.width, s.height));
+    engine.setPaintThreads(paintThreads);
+    const int keepEvery = qMax(1, strokes.count() / COMPOSITE_EVERY / ENCODE_FRAMES);
+    QElapsedTimer timer;
+    int drawn = 0;
+    for(const StrokeBatch &stroke: strokes){
+        timer.start();
+        engine.drawStroke(stroke);
+        paint->ns += timer.nsecsElapsed();
+        if(++drawn % COMPOSITE_EVERY){
+            continue;
+        }
+        // waiting for painters is paint's time, not composite's
+        timer.start();
+        paint->dabs = engine.dabCount();
+        paint->ns += timer.nsecsElapsed();
+        probe.stop(paint);
+
+        probe.start();
+        timer.start();
+        const QImage canvas = engine.allCanvas();
+        composite->ns += timer.nsecsElapsed();
+        ++composite->frames;
+        if(composite->frames % keepEvery == 0 && frames->count() < ENCODE_FRAMES){
+            frames->append(canvas.copy());
+        }
+        probe.stop(composite);
+        probe.start();
+    }
+    timer.start();
+    paint->dabs = engine.dabCount();
+    paint->ns += timer.nsecsElapsed();
+    paint->packs = engine.strokeCount();
+    paint->points = engine.pointCount();
+    probe.stop(paint);
+}
+
+static StageResult encode_stage(const QSize &size, const QVector<QImage> &frames,
+                                const QString &output)
+{
+    StageResult r;
+    RssProbe probe;
+    probe.start();
+    Encoder encoder;
+    if(frames.isEmpty() || !encoder.open(size, size, output, QString())){
+        return r;
+    }
+    QElapsedTimer timer;
+    timer.start();
+    for(const QImage &frame: frames){
+        encoder.onImage(frame);
+    }
+    encoder.finish();
+    r.ns = timer.nsecsElapsed();
+    r.frames = frames.count();
+    encoder.close();
+    probe.stop(&r);
+    return r;
+}
+
+static void print_stage(const char *name, const StageResult &r)
+{
+    const double seconds = qMax<qint64>(r.ns, 1) / 1e9;
+    printf("  %-10s %10.1f %12.0f %12.0f %12.0f %10.1f %10.1f %10.1f\n", name,
+           r.ns / 1e6, r.packs / seconds, r.points / seconds,
+           r.dabs / seconds, r.frames / seconds, r.rss / 1024.0,
+           r.rssGrowth / 1024.0);
+}
+
+int main(int argc, char *argv[])
+{
+    QGuiApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Replay throughput of every pipeline stage.");
+    parser.addHelpOption();
+    parser.addPositionalArgument("scenario", "Only run scenarios with these names.",
+                                 "[scenario...]");
+    QCommandLineOption saveOption("save",
+                                  "Also write generated archives to <dir>.",
+                                  "dir");
+    parser.addOption(saveOption);
+    QCommandLineOption paintThreadsOption("paint-threads",
+                                          "Threads painting strokes.",
+                                          "n", "1");
+    parser.addOption(paintThreadsOption);
+    QCommandLineOption bandThreadsOption("band-threads",
+                                         "Threads blending a stroke's dabs.",
+                                         "n", "1");
+    parser.addOption(bandThreadsOption);
+    parser.process(app);
+
+    const QStringList only = parser.positionalArguments();
+    const int paintThreads = qMax(1, parser.value(paintThreadsOption).toInt());
+    Layer::setBandThreads(qMax(1, parser.value(bandThreadsOption).toInt()));
+    QTemporaryDir temp;
+
+    printf("paint threads: %d, band threads: %d\n",
+           paintThreads, Layer::bandThreads());
+    for(const Scenario &s: scenarios){
+        if(!only.isEmpty() && !only.contains(s.name)){
+            continue;
+        }
+        const QByteArray archive = make_archive(s);
+        if(parser.isSet(saveOption)){
+            QFile file(QDir(parser.value(saveOption)).filePath(QString("%1.bin").arg(s.name)));
+            if(!file.open(QIODevice::WriteOnly) || file.write(archive) != archive.size()){
+                printf("cannot save %s\n", s.name);
+            }
+        }
+
+        QVector<StrokeBatch> strokes;
+        StageResult decode = decode_stage(archive, &strokes);
+        StageResult dispatch = dispatch_stage(strokes);
+        StageResult paint;
+        StageResult composite;
+        QVector<QImage> frames;
+        paint_stages(s, strokes, paintThreads, &paint, &composite, &frames);
+        StageResult encode = encode_stage(QSize(s.width, s.height), frames,
+                                          temp.filePath(QString("%1.mkv").arg(s.name)));
+
+        printf("%s: %dx%d, %d layers, %d packs, %.1f KiB\n", s.name,
+               s.width, s.height, s.layers, s.strokes, archive.size() / 1024.0);
+        printf("  %-10s %10s %12s %12s %12s %10s %10s %10s\n", "stage", "ms",
+               "packs/s", "points/s", "dabs/s", "frames/s", "peak MiB",
+               "+MiB");
+        print_stage("decode", decode);
+        print_stage("dispatch", dispatch);
+        print_stage("paint", paint);
+        print_stage("composite", composite);
+        print_stage("encode", encode);
+    }
+    return 0;
+}
@@ -0,0 +1,78 @@
+#-------------------------------------------------
+#
+# Replay throughput of every pipeline stage over
+# synthetic archives
+#
+#-------------------------------------------------
+
+QT       += core gui
+
+TARGET = replay
+CONFIG   += console
+CONFIG   -= app_bundle
+CONFIG += c++11
+
+TEMPLATE = app
+
+QMAKE_CXXFLAGS += -D__STDC_CONSTANT_MACROS
+
+INCLUDEPATH += $$PWD/../../encoder/ffmpeg/include
+
+win32: LIBS += -L$$PWD/../../encoder/ffmpeg/bin -lavcodec-55 -lavformat-55 -lavutil-52 -lswscale-2
+unix: LIBS += -lavcodec -lavformat -lavutil -lswscale -lz
+win32: INCLUDEPATH += $$[QT_INSTALL_HEADERS]/QtZlib
+
+SOURCES += main.cpp \
+    ../../canvasengine.cpp \
+    ../../canvasbackend.cpp \
+    ../../misc/layer.cpp \
+    ../../misc/layermanager.cpp \
+    ../../misc/packparser.cpp \
+    ../../misc/strokecodec.cpp \
+    ../../misc/snapshotscheduler.cpp \
+    ../../misc/layerscheduler.cpp \
+    ../../misc/packdecoder.cpp \
+    ../../misc/archiveindex.cpp \
+    ../../misc/cpufeatures.cpp \
+    ../../brush/abstractbrush.cpp \
+    ../../brush/basicbrush.cpp \
+    ../../brush/basiceraser.cpp \
+    ../../brush/binarybrush.cpp \
+    ../../brush/brushfeature.cpp \
+    ../../brush/brushmanager.cpp \
+    ../../brush/dabcompositor.cpp \
+    ../../brush/maskbased.cpp \
+    ../../brush/sketchbrush.cpp \
+    ../../brush/waterbased.cpp \
+    ../../encoder/encoder.cpp \
+    ../../encoder/yuvconvert.cpp
+
+HEADERS += \
+    ../../canvasengine.h \
+    ../../canvasbackend.h \
+    ../../misc/layer.h \
+    ../../misc/layermanager.h \
+    ../../misc/packparser.h \
+    ../../misc/strokebatch.h \
+    ../../misc/strokecodec.h \
+    ../../misc/snapshotscheduler.h \
+    ../../misc/layerscheduler.h \
+    ../../misc/spscring.h \
+    ../../misc/packdecoder.h \
+    ../../misc/archiveindex.h \
+    ../../misc/cpufeatures.h \
+    ../../brush/abstractbrush.h \
+    ../../brush/basicbrush.h \
+    ../../brush/basiceraser.h \
+    ../../brush/binarybrush.h \
+    ../../brush/brushfeature.h \
+    ../../brush/brushmanager.h \
+    ../../brush/dabcompositor.h \
+    ../../brush/maskbased.h \
+    ../../brush/sketchbrush.h \
+    ../../brush/waterbased.h \
+    ../../encoder/encoder.h \
+    ../../encoder/yuvconvert.h
+
+RESOURCES += \
+    ../../res.qrc
@@ -0,0 +1,150 @@
+#include <QGuiApplication>
+#include <QImage>
+#include <QPainter>
+#include <QLinearGradient>
+#include <QElapsedTimer>
+#include <QThread>
+#include <QVector>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+
+extern "C" {
+#include "libswscale/swscale.h"
+#include "libavutil/pixfmt.h"
+}
+
+#include "../../encoder/yuvconvert.h"
+
+// largest difference to swscale accepted, in levels
+static const int tolerance = 3;
+// YuvConvert averages 2x2 blocks for chroma, which is what SWS_AREA does;
+// other filters blur chroma across edges and differ by 10+ levels there
+static const int reference_flags = SWS_AREA;
+static const int frames = 20;
+
+struct Planes
+{
+    Planes(const QSize &size)
+        :y(size.width() * size.height()),
+          u((size.width() / 2) * (size.height() / 2)),
+          v(u.size())
+    {
+        data[0] = y.data();
+        data[1] = u.data();
+        data[2] = v.data();
+        linesize[0] = size.width();
+        linesize[1] = size.width() / 2;
+        linesize[2] = size.width() / 2;
+    }
+
+    QVector<uchar> y;
+    QVector<uchar> u;
+    QVector<uchar> v;
+    uchar *data[3];
+    int linesize[3];
+};
+
+// something like a composite: white paper, gradients and strokes
+static QImage make_canvas(const QSize &size)
+{
+    QImage canvas(size, QImage::Format_ARGB32_Premultiplied);
+    canvas.fill(Qt::white);
+    QPainter painter(&canvas);
+    painter.setRenderHint(QPainter::Antialiasing);
+    QLinearGradient gradient(0, 0, size.width(), size.height());
+    gradient.setColorAt(0, QColor(255, 240, 200));
+    gradient.setColorAt(1, QColor(40, 80, 160));
+    painter.fillRect(0, size.height() / 2, size.width(), size.height() / 2, gradient);
+    std::mt19937 rng(size.width());
+    for(int i=0;i<500;++i){
+        painter.setPen(QPen(QColor(rng() % 256, rng() % 256, rng() % 256, 80 + rng() % 176),
+                            1 + rng() % 30, Qt::SolidLine, Qt::RoundCap));
+        painter.drawLine(rng() % size.width(), rng() % size.height(),
+                         rng() % size.width(), rng() % size.height());
+    }
+    return canvas;
+}
+
+static void compare(const QVector<uchar> &a, const QVector<uchar> &b,
+                    int *max, double *mean)
+{
+    qint64 sum = 0;
+    *max = 0;
+    for(int i=0;i<a.size();++i){
+        const int d = std::abs(a[i] - b[i]);
+        *max = qMax(*max, d);
+        sum += d;
+    }
+    *mean = double(sum) / a.size();
+}
+
+int main(int argc, char *argv[])
+{
+    QGuiApplication app(argc, argv);
+
+    const QSize sizes[] = {QSize(1920, 1080), QSize(3840, 2160)};
+    const YuvConvert::Kernel kernels[] = {
+        YuvConvert::SCALAR,
+        YuvConvert::SSE2,
+        YuvConvert::AVX2
+    };
+    const YuvConvert::Kernel selected = YuvConvert::kernel();
+    const int ideal = QThread::idealThreadCount();
+    bool failed = false;
+
+    printf("selected kernel: %s, tolerance: %d\n",
+           YuvConvert::kernelName(selected), tolerance);
+    printf("%10s %10s %8s %10s %16s %16s %16s\n", "size", "path", "threads",
+           "ms/frame", "y max/mean", "u max/mean", "v max/mean");
+    for(const QSize &size: sizes){
+        const QImage canvas = make_canvas(size);
+        const QString name = QString("%1x%2").arg(size.width()).arg(size.height());
+
+        Planes reference(size);
+        SwsContext *ctx = sws_getContext(size.width(), size.height(), AV_PIX_FMT_RGB32,
+                                         size.width(), size.height(), AV_PIX_FMT_YUV420P,
+                                         reference_flags, 0, 0, 0);
+        const uint8_t *in[1] = { canvas.constBits() };
+        const int inLinesize[1] = { canvas.bytesPerLine() };
+        QElapsedTimer timer;
+        timer.start();
+        for(int i=0;i<frames;++i){
+            sws_scale(ctx, in, inLinesize, 0, size.height(),
+                      reference.data, reference.linesize);
+        }
+        printf("%10s %10s %8d %10.2f\n", qPrintable(name), "swscale", 1,
+               timer.nsecsElapsed() / 1e6 / frames);
+        sws_freeContext(ctx);
+
+        for(YuvConvert::Kernel k: kernels){
+            if(!YuvConvert::setKernel(k)){
+                continue;
+            }
+            for(int threads: {1, ideal}){
+                Planes planes(size);
+                timer.restart();
+                for(int i=0;i<frames;++i){
+                    YuvConvert::convert(canvas.constBits(), canvas.bytesPerLine(),
+                                        size.width(), size.height(),
+                                        planes.data, planes.linesize, threads);
+                }
+                const double ms = timer.nsecsElapsed() / 1e6 / frames;
+                int max[3];
+                double mean[3];
+                compare(planes.y, reference.y, &max[0], &mean[0]);
+                compare(planes.u, reference.u, &max[1], &mean[1]);
+                compare(planes.v, reference.v, &max[2], &mean[2]);
+                const bool off = max[0] > tolerance || max[1] > tolerance
+                        || max[2] > tolerance;
+                failed = failed || off;
+                printf("%10s %10s %8d %10.2f %9d/%6.3f %9d/%6.3f %9d/%6.3f%s\n",
+                       qPrintable(name), YuvConvert::kernelName(k), threads, ms,
+                       max[0], mean[0], max[1], mean[1], max[2], mean[2],
+                       off ? "  OUT OF TOLERANCE" : "");
+            }
+        }
+        YuvConvert::setKernel(selected);
+    }
+    return failed ? 1 : 0;
+}
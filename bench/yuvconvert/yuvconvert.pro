@@ -0,0 +1,29 @@
+#-------------------------------------------------
+#
+# Benchmark of YuvConvert against swscale
+#
+#-------------------------------------------------
+
+QT       += core gui
+
+TARGET = yuvconvert
+CONFIG   += console
+CONFIG   -= app_bundle
+CONFIG += c++11
+
+TEMPLATE = app
+
+QMAKE_CXXFLAGS += -D__STDC_CONSTANT_MACROS
+
+INCLUDEPATH += $$PWD/../../encoder/ffmpeg/include
+
+win32: LIBS += -L$$PWD/../../encoder/ffmpeg/bin -lavutil-52 -lswscale-2
+unix: LIBS += -lavutil -lswscale
+
+SOURCES += main.cpp \
+    ../../encoder/yuvconvert.cpp \
+    ../../misc/cpufeatures.cpp
+
+HEADERS += \
+    ../../encoder/yuvconvert.h \
+    ../../misc/cpufeatures.h
@@ -9,7 +9,9 @@ AbstractBrush::AbstractBrush():
     width_(10),
     thickness_(BFL::THICKNESS_MAX),
     color_(Qt::black),
-    surface_(nullptr)
+    surface_(nullptr),
+    settings_applied_(false),
+    cursor_width_(0)
 {
     typedef BrushFeature BF;
     BF::FeatureBits bits;
@@ -41,6 +43,12 @@ QIcon AbstractBrush::icon()
 
 QCursor AbstractBrush::cursor()
 {
+    // cursor pixmaps can only be made in GUI thread, while brushes may
+    // paint in any thread, so the cursor is only built when asked for
+    if(cursor_width_ != width_){
+        updateCursor(width_);
+        cursor_width_ = width_;
+    }
     return cursor_;
 }
 
@@ -63,7 +71,7 @@ void AbstractBrush::setWidth(int width)
 {
     width_ = qBound<int>(BFL::WIDTH_MIN, width, BFL::WIDTH_MAX);
     settings_.insert("width", width_);
-    updateCursor(width);
+    settings_applied_ = false;
 }
 int AbstractBrush::thickness() const
 {
@@ -74,6 +82,7 @@ void AbstractBrush::setThickness(int thickness)
 {
     thickness_ = qBound<int>(BFL::THICKNESS_MIN, thickness, BFL::THICKNESS_MAX);
     settings_.insert("thickness", thickness_);
+    settings_applied_ = false;
 }
 
 Surface AbstractBrush::surface() const
@@ -96,6 +105,17 @@ BrushFeature AbstractBrush::features()
     return features_;
 }
 
+void AbstractBrush::drawStroke(const QVector<StrokePoint> &points)
+{
+    if(points.isEmpty()){
+        return;
+    }
+    drawPoint(QPoint(points[0].x, points[0].y), points[0].pressure);
+    for(int i=1;i<points.count();++i){
+        drawLineTo(QPoint(points[i].x, points[i].y), points[i].pressure);
+    }
+}
+
 BrushSettings AbstractBrush::settings() const
 {
     return settings_;
@@ -114,6 +134,18 @@ void AbstractBrush::setSettings(const BrushSettings &settings)
     settings_ = s;
 }
 
+// same as setSettings(), but does nothing if brush is already in the
+// state these settings lead to, which is the common case while replaying
+void AbstractBrush::applySettings(const BrushSettings &settings)
+{
+    if(settings_applied_ && settings == applied_settings_){
+        return;
+    }
+    setSettings(settings);
+    applied_settings_ = settings;
+    settings_applied_ = true;
+}
+
 BrushSettings AbstractBrush::defaultSettings() const
 {
     BrushSettings s;
@@ -127,6 +159,25 @@ BrushSettings AbstractBrush::defaultSettings() const
     return s;
 }
 
+QVariantMap AbstractBrush::state() const
+{
+    QVariantMap s;
+    if(settings_applied_){
+        s.insert("settings", applied_settings_);
+    }
+    s.insert("lastPoint", last_point_);
+    return s;
+}
+
+// settings go first, setting them may reset what follows
+void AbstractBrush::setState(const QVariantMap &state)
+{
+    if(state.contains("settings")){
+        applySettings(state.value("settings").toMap());
+    }
+    last_point_ = state.value("lastPoint").toPoint();
+}
+
 void AbstractBrush::updateCursor(int w)
 {
     int frame = w+2+w%2; // +2 for a border padding
@@ -163,4 +214,5 @@ void AbstractBrush::setColor(const QColor &color)
     colorMap.insert("green", color_.green());
     colorMap.insert("blue", color_.blue());
     settings_.insert("color", colorMap);
+    settings_applied_ = false;
 }
@@ -11,6 +11,7 @@
 #include "brushfeature.h"
 #include "brushsettings.h"
 #include "../misc/layer.h"
+#include "../misc/strokebatch.h"
 typedef LayerPointer Surface;
 
 class AbstractBrush
@@ -44,12 +45,20 @@ public:
 
     virtual void drawPoint(const QPoint& p, qreal pressure=1)=0;
     virtual void drawLineTo(const QPoint& end, qreal pressure=1)=0;
+    // first point starts the stroke, as drawPoint() does
+    virtual void drawStroke(const QVector<StrokePoint>& points);
 
     virtual BrushSettings settings() const;
     virtual void setSettings(const BrushSettings &settings);
+    void applySettings(const BrushSettings &settings);
     virtual BrushSettings defaultSettings() const;
     virtual AbstractBrush* createBrush()=0;
 
+    // what brush carries from one stroke to the next, for checkpoints;
+    // subclasses add their own on top of base class' state
+    virtual QVariantMap state() const;
+    virtual void setState(const QVariantMap &state);
+
 protected:
     int width_;
     int thickness_;
@@ -58,12 +67,15 @@ protected:
     QImage stencil_;
     QPoint last_point_;
     BrushSettings settings_;
+    BrushSettings applied_settings_;
+    bool settings_applied_;   // if state still matches applied_settings_
     BrushFeature features_;
 
     QString name_;
     QString displayName_;
     QIcon icon_;
     QCursor cursor_;
+    int cursor_width_;
     QKeySequence shortcut_;
 
     virtual void updateCursor(int w);
@@ -6,6 +6,9 @@
 #include <QBrush>
 #include <QtCore/qmath.h>
 #include <QtGlobal>
+#include <QCache>
+#include <QMutex>
+#include <QMutexLocker>
 #include <QDebug>
 
 #include "../misc/singleton.h"
@@ -14,10 +17,52 @@
 
 typedef BrushFeature::LIMIT BFL;
 
+// dabs of a stroke are blended in chunks of at most this many
+static const int MAX_PENDING_DABS = 512;
+
+// Stencils shared by every brush in process, since brushes of different
+// clients (or engines) tend to use the same few settings.
+class StencilCache
+{
+public:
+    typedef QPair<QString, quint64> Key;
+
+    StencilCache():
+        cache_(16*1024) // in KiB
+    {
+    }
+
+    bool find(const Key &key, QImage &stencil)
+    {
+        QMutexLocker locker(&mutex_);
+        QImage *cached = cache_.object(key);
+        if(!cached){
+            return false;
+        }
+        stencil = *cached;
+        return true;
+    }
+
+    void insert(const Key &key, const QImage &stencil)
+    {
+        QMutexLocker locker(&mutex_);
+        cache_.insert(key, new QImage(stencil), qMax(1, stencil.byteCount() >> 10));
+    }
+private:
+    QMutex mutex_;
+    QCache<Key, QImage> cache_;
+};
+
+Q_GLOBAL_STATIC(StencilCache, stencil_cache)
+
 BasicBrush::BasicBrush() :
     AbstractBrush(),
     left_(0),
-    hardness_(BFL::HARDNESS_MAX)
+    hardness_(BFL::HARDNESS_MAX),
+    defer_stencil_(false),
+    stencil_valid_(false),
+    pressure_levels_(64),
+    pending_dabs_(nullptr)
 {
     typedef BrushFeature BF;
     BF::FeatureBits bits;
@@ -33,19 +78,78 @@ BasicBrush::BasicBrush() :
 void BasicBrush::setWidth(int width)
 {
     AbstractBrush::setWidth(width);
-    makeStencil(color_);
+    updateStencil();
 }
 
 void BasicBrush::setColor(const QColor &color)
 {
     AbstractBrush::setColor(color);
-    makeStencil(color_);
+    updateStencil();
 }
 
 void BasicBrush::setThickness(int thickness)
 {
     AbstractBrush::setThickness(thickness);
-    makeStencil(color_);
+    updateStencil();
+}
+
+// stencil only depends on brush type, width, color, hardness and thickness,
+// so it's only made when one of them really changed and not in cache yet
+void BasicBrush::updateStencil()
+{
+    if(defer_stencil_){
+        return;
+    }
+    const quint64 params = (quint64(color_.rgba()) << 32)
+            | (quint64(width_) << 16)
+            | (quint64(hardness_) << 8)
+            | quint64(thickness_);
+    const StencilKey key(name_, params);
+    if(stencil_valid_ && key == stencil_key_){
+        return;
+    }
+    if(!stencil_cache()->find(key, stencil_)){
+        makeStencil(color_);
+        stencil_cache()->insert(key, stencil_);
+    }
+    stencil_key_ = key;
+    stencil_valid_ = true;
+    pressure_stencils_.fill(QImage());
+}
+
+int BasicBrush::pressureLevels() const
+{
+    return pressure_levels_;
+}
+
+// 0 turns quantization off, and stencil is scaled for every pressure
+void BasicBrush::setPressureLevels(int levels)
+{
+    pressure_levels_ = qMax(0, levels);
+    pressure_stencils_.clear();
+}
+
+// Pressure is quantized to pressure_levels_ steps, and each step's scaled
+// stencil is made once per stencil change rather than once per dab.
+QImage BasicBrush::pressureStencil(qreal pressure)
+{
+    const int levels = pressure_levels_;
+    const int level = qRound(pressure * levels);
+    if(!levels || level > levels){
+        return stencil_.scaledToWidth(stencil_.width()*pressure);
+    }
+    if(level <= 0){
+        return QImage();
+    }
+    if(pressure_stencils_.size() != levels){
+        pressure_stencils_.resize(levels);
+    }
+    QImage &scaled = pressure_stencils_[level-1];
+    if(scaled.isNull()){
+        scaled = level == levels ? stencil_
+                                 : stencil_.scaledToWidth(stencil_.width()*level/levels);
+    }
+    return scaled;
 }
 
 void BasicBrush::makeStencil(QColor color)
@@ -86,41 +190,75 @@ void BasicBrush::makeStencil(QColor color)
     painter.end();
 }
 
+// painter is not used anymore, dabs are blended straight into layer
 void BasicBrush::drawPointInternal(const QPoint &p,
                                    const QImage& stencil,
-                                   QPainter* painter)
+                                   QPainter*)
 {
     // TODO: add pressure
-    bool need_delete = false;
-    if(!painter) {
-        painter = new QPainter;
-        need_delete = true;
-        painter->setRenderHint(QPainter::Antialiasing);
-        painter->begin(surface_->imagePtr());
+    blendDab(stencil, p);
+}
+
+// subclasses go through here, so drawStroke() can collect their dabs
+void BasicBrush::blendDab(const QImage &dab, const QPoint &p)
+{
+    if(!pending_dabs_){
+        surface_->blendDab(dab, p);
+        return;
     }
-    painter->drawImage(p.x(), p.y(), stencil);
-    if(need_delete) {
-        painter->end();
-        delete painter;
+    pending_dabs_->append(Layer::Dab{dab, p});
+    if(pending_dabs_->count() >= MAX_PENDING_DABS){
+        flushDabs();
     }
 }
 
+void BasicBrush::flushDabs()
+{
+    surface_->blendDabs(*pending_dabs_);
+    pending_dabs_->clear();
+}
+
 void BasicBrush::drawPoint(const QPoint &p, qreal pr)
 {
-    QPainter painter(surface_->imagePtr());
-    painter.setRenderHint(QPainter::Antialiasing);
-    QImage pressure_stencil = stencil_.scaledToWidth(stencil_.width()*pr);
+    stampPoint(p, pr);
+}
+
+void BasicBrush::drawLineTo(const QPoint &end, qreal pressure)
+{
+    stampLineTo(end, pressure);
+}
+
+// dab positions of whole stroke are worked out first, then blended
+// together by Layer::blendDabs()
+void BasicBrush::drawStroke(const QVector<StrokePoint> &points)
+{
+    if(points.isEmpty()){
+        return;
+    }
+    QVector<Layer::Dab> dabs;
+    pending_dabs_ = &dabs;
+    stampPoint(QPoint(points[0].x, points[0].y), points[0].pressure);
+    for(int i=1;i<points.count();++i){
+        stampLineTo(QPoint(points[i].x, points[i].y), points[i].pressure);
+    }
+    flushDabs();
+    pending_dabs_ = nullptr;
+}
+
+void BasicBrush::stampPoint(const QPoint &p, qreal pr)
+{
+    const QImage pressure_stencil = pressureStencil(pr);
     drawPointInternal(QPoint(p.x() - (pressure_stencil.width()>>1),
                              p.y() - (pressure_stencil.height()>>1)),
                       pressure_stencil,
-                      &painter);
+                      nullptr);
     last_point_ = p;
 }
 
-void BasicBrush::drawLineTo(const QPoint &end, qreal pressure)
+void BasicBrush::stampLineTo(const QPoint &end, qreal pressure)
 {
-    if(end.x() > surface_->imageConstPtr()->width() || end.x() < 0
-            || end.y() > surface_->imageConstPtr()->height() || end.y() < 0) {
+    if(end.x() > surface_->size().width() || end.x() < 0
+            || end.y() > surface_->size().height() || end.y() < 0) {
         return;
     }
     const QPoint& start = last_point_;
@@ -143,11 +281,8 @@ void BasicBrush::drawLineTo(const QPoint &end, qreal pressure)
     qreal offsetY = 0.0;
 
     qreal totalDistance = left_ + distance;
-    // TODO
-    QImage pressure_stencil = stencil_.scaledToWidth(stencil_.width()*pressure);
+    const QImage pressure_stencil = pressureStencil(pressure);
 
-    QPainter painter(surface_->imagePtr());
-    painter.setRenderHint(QPainter::Antialiasing);
     while ( totalDistance >= spacing ) {
         if ( left_ > 0.0 ) {
             offsetX += stepX * (spacing - left_);
@@ -155,7 +290,7 @@ void BasicBrush::drawLineTo(const QPoint &end, qreal pressure)
             drawPointInternal(QPoint(start.x() + offsetX - (pressure_stencil.width()>>1),
                                      start.y() + offsetY - (pressure_stencil.height()>>1)),
                               pressure_stencil,
-                              &painter);
+                              nullptr);
             left_ -= spacing;
         } else {
             offsetX += stepX * spacing;
@@ -163,7 +298,7 @@ void BasicBrush::drawLineTo(const QPoint &end, qreal pressure)
             drawPointInternal(QPoint(start.x() + offsetX - (pressure_stencil.width()>>1),
                                      start.y() + offsetY - (pressure_stencil.height()>>1)),
                               pressure_stencil,
-                              &painter);
+                              nullptr);
         }
         totalDistance -= spacing;
     }
@@ -184,13 +319,18 @@ void BasicBrush::setHardness(int hardness)
 {
     hardness_ = qBound<int>(BFL::HARDNESS_MIN, hardness, BFL::HARDNESS_MAX);
     settings_.insert("hardness", hardness_);
-    makeStencil(color_);
+    settings_applied_ = false;
+    updateStencil();
 }
 
 void BasicBrush::setSettings(const BrushSettings &settings)
 {
+    // every setter wants a new stencil, make it only once at the end
+    defer_stencil_ = true;
     AbstractBrush::setSettings(settings);
     setHardness(settings.value("hardness").toInt());
+    defer_stencil_ = false;
+    updateStencil();
 }
 
 BrushSettings BasicBrush::defaultSettings() const
@@ -200,3 +340,16 @@ BrushSettings BasicBrush::defaultSettings() const
     return s;
 }
 
+
+QVariantMap BasicBrush::state() const
+{
+    auto s = AbstractBrush::state();
+    s.insert("left", left_);
+    return s;
+}
+
+void BasicBrush::setState(const QVariantMap &state)
+{
+    AbstractBrush::setState(state);
+    left_ = state.value("left").toReal();
+}
@@ -3,6 +3,8 @@
 
 #include "abstractbrush.h"
 #include <QImage>
+#include <QPair>
+#include <QVector>
 
 class BasicBrush : public AbstractBrush
 {
@@ -14,24 +16,43 @@ public:
 
     void drawPoint(const QPoint& p, qreal pressure=1) Q_DECL_OVERRIDE;
     void drawLineTo(const QPoint& end, qreal pressure=1) Q_DECL_OVERRIDE;
+    void drawStroke(const QVector<StrokePoint>& points) Q_DECL_OVERRIDE;
 
     AbstractBrush* createBrush() Q_DECL_OVERRIDE;
 
     int hardness() const;
     void setHardness(int hardness);
+    int pressureLevels() const;
+    void setPressureLevels(int levels);
 
     void setSettings(const BrushSettings &settings) Q_DECL_OVERRIDE;
     BrushSettings defaultSettings() const Q_DECL_OVERRIDE;
+    QVariantMap state() const Q_DECL_OVERRIDE;
+    void setState(const QVariantMap &state) Q_DECL_OVERRIDE;
 
 signals:
 
 public slots:
 
 protected:
+    typedef QPair<QString, quint64> StencilKey;
+
     qreal left_;
     int hardness_;
+    bool defer_stencil_;
+    bool stencil_valid_;    // if stencil_ is the one of stencil_key_
+    StencilKey stencil_key_;
+    int pressure_levels_;
+    QVector<QImage> pressure_stencils_;    // built on demand, see pressureStencil()
+    QVector<Layer::Dab> *pending_dabs_;   // collects dabs in drawStroke()
+    void updateStencil();
+    QImage pressureStencil(qreal pressure);
     virtual void makeStencil(QColor color);
     virtual void drawPointInternal(const QPoint& p, const QImage &stencil, QPainter *painter);
+    void blendDab(const QImage &dab, const QPoint &p);
+    void flushDabs();
+    void stampPoint(const QPoint& p, qreal pressure);
+    void stampLineTo(const QPoint& end, qreal pressure);
 };
 
 #endif // BASICBRUSH_H
@@ -20,29 +20,36 @@ BasicEraser::BasicEraser()
 void BasicEraser::drawPoint(const QPoint &p, qreal )
 {
     pen_.setWidth(width_);
-    painter_.begin(surface_->imagePtr());
-    painter_.setRenderHint(QPainter::Antialiasing);
-    painter_.setCompositionMode(QPainter::CompositionMode_Clear);
-    painter_.setPen(pen_);
-    painter_.setBrush(brush_);
-    painter_.drawPoint(p);
-    painter_.end();
+    const int r = width_ / 2 + 2;
+    surface_->paint(QRect(p, p).adjusted(-r, -r, r, r),
+                    [this, p](QPainter *painter) {
+        setupPainter(painter);
+        painter->drawPoint(p);
+    }, true);
     last_point_ = p;
 }
 
 void BasicEraser::drawLineTo(const QPoint &end, qreal )
 {
     pen_.setWidth(width_);
-    painter_.begin(surface_->imagePtr());
-    painter_.setRenderHint(QPainter::Antialiasing);
-    painter_.setCompositionMode(QPainter::CompositionMode_Clear);
-    painter_.setPen(pen_);
-    painter_.setBrush(brush_);
-    painter_.drawLine(last_point_, end);
-    painter_.end();
+    const int r = width_ / 2 + 2;
+    const QPoint start = last_point_;
+    surface_->paint(QRect(start, end).normalized().adjusted(-r, -r, r, r),
+                    [this, start, end](QPainter *painter) {
+        setupPainter(painter);
+        painter->drawLine(start, end);
+    }, true);
     last_point_ = end;
 }
 
+void BasicEraser::setupPainter(QPainter *painter)
+{
+    painter->setRenderHint(QPainter::Antialiasing);
+    painter->setCompositionMode(QPainter::CompositionMode_Clear);
+    painter->setPen(pen_);
+    painter->setBrush(brush_);
+}
+
 AbstractBrush *BasicEraser::createBrush()
 {
     return new BasicEraser;
@@ -17,7 +17,8 @@ public:
 protected:
     QBrush brush_;
     QPen pen_;
-    QPainter painter_;
+private:
+    void setupPainter(QPainter *painter);
 };
 
 #endif // BASICERASER_H
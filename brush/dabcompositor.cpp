@@ -0,0 +1,225 @@
+#include "dabcompositor.h"
+
+#include <QImage>
+#include <QRect>
+#include <QPoint>
+
+#include "../misc/cpufeatures.h"
+
+#if defined(Q_PROCESSOR_X86)
+#include <emmintrin.h>
+#include <immintrin.h>
+#endif
+
+#if defined(Q_PROCESSOR_X86) && defined(Q_CC_GNU)
+#define DAB_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define DAB_TARGET_AVX2
+#endif
+
+typedef void (*BlendFunc)(quint32 *dst, const quint32 *src, int count);
+
+static void blend_scalar(quint32 *dst, const quint32 *src, int count)
+{
+    for(int i=0;i<count;++i){
+        const quint32 s = src[i];
+        const quint32 alpha = s >> 24;
+        if(alpha == 0xff){
+            dst[i] = s;
+        }else if(alpha){
+            dst[i] = s + DabCompositor::byteMul(dst[i], 0xff - alpha);
+        }
+    }
+}
+
+#if defined(Q_PROCESSOR_X86)
+
+// dst * ia / 255 in 16 bit lanes, with Qt's rounding
+static inline __m128i byte_mul_sse2(__m128i d, __m128i ia)
+{
+    const __m128i mask = _mm_set1_epi32(0x00ff00ff);
+    const __m128i half = _mm_set1_epi16(0x80);
+    __m128i even = _mm_and_si128(d, mask);
+    __m128i odd = _mm_and_si128(_mm_srli_epi16(d, 8), mask);
+    even = _mm_mullo_epi16(even, ia);
+    odd = _mm_mullo_epi16(odd, ia);
+    even = _mm_add_epi16(_mm_add_epi16(even, _mm_srli_epi16(even, 8)), half);
+    odd = _mm_add_epi16(_mm_add_epi16(odd, _mm_srli_epi16(odd, 8)), half);
+    even = _mm_srli_epi16(even, 8);
+    odd = _mm_andnot_si128(mask, odd);
+    return _mm_or_si128(even, odd);
+}
+
+static void blend_sse2(quint32 *dst, const quint32 *src, int count)
+{
+    const __m128i alpha_mask = _mm_set1_epi32(0xff000000);
+    const __m128i ff = _mm_set1_epi32(0xff);
+    int i = 0;
+    for(;i+4<=count;i+=4){
+        const __m128i s = _mm_loadu_si128((const __m128i*)(src+i));
+        const __m128i a = _mm_and_si128(s, alpha_mask);
+        const int opaque = _mm_movemask_epi8(_mm_cmpeq_epi32(a, alpha_mask));
+        if(opaque == 0xffff){
+            _mm_storeu_si128((__m128i*)(dst+i), s);
+            continue;
+        }
+        const int transparent = _mm_movemask_epi8(_mm_cmpeq_epi32(a, _mm_setzero_si128()));
+        if(transparent == 0xffff){
+            continue;
+        }
+        const __m128i d = _mm_loadu_si128((const __m128i*)(dst+i));
+        __m128i ia = _mm_sub_epi32(ff, _mm_srli_epi32(s, 24));
+        ia = _mm_or_si128(ia, _mm_slli_epi32(ia, 16));
+        const __m128i r = _mm_add_epi8(s, byte_mul_sse2(d, ia));
+        _mm_storeu_si128((__m128i*)(dst+i), r);
+    }
+    blend_scalar(dst+i, src+i, count-i);
+}
+
+DAB_TARGET_AVX2
+static inline __m256i byte_mul_avx2(__m256i d, __m256i ia)
+{
+    const __m256i mask = _mm256_set1_epi32(0x00ff00ff);
+    const __m256i half = _mm256_set1_epi16(0x80);
+    __m256i even = _mm256_and_si256(d, mask);
+    __m256i odd = _mm256_and_si256(_mm256_srli_epi16(d, 8), mask);
+    even = _mm256_mullo_epi16(even, ia);
+    odd = _mm256_mullo_epi16(odd, ia);
+    even = _mm256_add_epi16(_mm256_add_epi16(even, _mm256_srli_epi16(even, 8)), half);
+    odd = _mm256_add_epi16(_mm256_add_epi16(odd, _mm256_srli_epi16(odd, 8)), half);
+    even = _mm256_srli_epi16(even, 8);
+    odd = _mm256_andnot_si256(mask, odd);
+    return _mm256_or_si256(even, odd);
+}
+
+DAB_TARGET_AVX2
+static void blend_avx2(quint32 *dst, const quint32 *src, int count)
+{
+    const __m256i alpha_mask = _mm256_set1_epi32(0xff000000);
+    const __m256i ff = _mm256_set1_epi32(0xff);
+    int i = 0;
+    for(;i+8<=count;i+=8){
+        const __m256i s = _mm256_loadu_si256((const __m256i*)(src+i));
+        const __m256i a = _mm256_and_si256(s, alpha_mask);
+        const int opaque = _mm256_movemask_epi8(_mm256_cmpeq_epi32(a, alpha_mask));
+        if(opaque == -1){
+            _mm256_storeu_si256((__m256i*)(dst+i), s);
+            continue;
+        }
+        const int transparent = _mm256_movemask_epi8(_mm256_cmpeq_epi32(a, _mm256_setzero_si256()));
+        if(transparent == -1){
+            continue;
+        }
+        const __m256i d = _mm256_loadu_si256((const __m256i*)(dst+i));
+        __m256i ia = _mm256_sub_epi32(ff, _mm256_srli_epi32(s, 24));
+        ia = _mm256_or_si256(ia, _mm256_slli_epi32(ia, 16));
+        const __m256i r = _mm256_add_epi8(s, byte_mul_avx2(d, ia));
+        _mm256_storeu_si256((__m256i*)(dst+i), r);
+    }
+    blend_scalar(dst+i, src+i, count-i);
+}
+
+#endif // Q_PROCESSOR_X86
+
+static bool cpu_supports(DabCompositor::Kernel k)
+{
+    switch(k){
+    case DabCompositor::SCALAR:
+        return true;
+#if defined(Q_PROCESSOR_X86)
+    case DabCompositor::SSE2:
+        return CpuFeatures::hasSse2();
+    case DabCompositor::AVX2:
+        return CpuFeatures::hasAvx2();
+#endif
+    default:
+        return false;
+    }
+}
+
+static BlendFunc blend_func(DabCompositor::Kernel k)
+{
+    switch(k){
+#if defined(Q_PROCESSOR_X86)
+    case DabCompositor::SSE2:
+        return blend_sse2;
+    case DabCompositor::AVX2:
+        return blend_avx2;
+#endif
+    default:
+        return blend_scalar;
+    }
+}
+
+static DabCompositor::Kernel best_kernel()
+{
+    if(cpu_supports(DabCompositor::AVX2)){
+        return DabCompositor::AVX2;
+    }
+    if(cpu_supports(DabCompositor::SSE2)){
+        return DabCompositor::SSE2;
+    }
+    return DabCompositor::SCALAR;
+}
+
+static DabCompositor::Kernel current_kernel = best_kernel();
+static BlendFunc current_func = blend_func(current_kernel);
+
+DabCompositor::Kernel DabCompositor::kernel()
+{
+    return current_kernel;
+}
+
+bool DabCompositor::setKernel(DabCompositor::Kernel k)
+{
+    if(!cpu_supports(k)){
+        return false;
+    }
+    current_kernel = k;
+    current_func = blend_func(k);
+    return true;
+}
+
+bool DabCompositor::supports(DabCompositor::Kernel k)
+{
+    return cpu_supports(k);
+}
+
+const char* DabCompositor::kernelName(DabCompositor::Kernel k)
+{
+    switch(k){
+    case SSE2:
+        return "sse2";
+    case AVX2:
+        return "avx2";
+    default:
+        return "scalar";
+    }
+}
+
+void DabCompositor::blendSpan(quint32 *dst, const quint32 *src, int count)
+{
+    current_func(dst, src, count);
+}
+
+void DabCompositor::blend(QImage *dst, const QImage &dab, const QPoint &pos)
+{
+    if(dab.isNull()){
+        return;
+    }
+    Q_ASSERT(dst->format() == QImage::Format_ARGB32_Premultiplied);
+    Q_ASSERT(dab.format() == QImage::Format_ARGB32_Premultiplied);
+
+    const QRect area = QRect(pos, dab.size()) & dst->rect();
+    if(area.isEmpty()){
+        return;
+    }
+    const int sx = area.x() - pos.x();
+    const int sy = area.y() - pos.y();
+    const BlendFunc func = current_func;
+    for(int y=0;y<area.height();++y){
+        quint32 *d = (quint32*)dst->scanLine(area.y() + y) + area.x();
+        const quint32 *s = (const quint32*)dab.constScanLine(sy + y) + sx;
+        func(d, s, area.width());
+    }
+}
@@ -0,0 +1,49 @@
+#ifndef DABCOMPOSITOR_H
+#define DABCOMPOSITOR_H
+
+#include <QtGlobal>
+
+class QImage;
+class QPoint;
+
+/*
+ * DabCompositor stamps integer positioned dabs onto a layer with
+ * source-over, which is all QPainter::drawImage() does for them, minus
+ * its setup cost. Both images must be Format_ARGB32_Premultiplied.
+ *
+ * Results are bit-identical to QPainter, every kernel uses the same
+ * rounding as Qt's raster engine.
+ */
+class DabCompositor
+{
+public:
+    enum Kernel {
+        SCALAR = 0,
+        SSE2,
+        AVX2
+    };
+
+    static Kernel kernel();
+    // for benchmarks, returns false if cpu cannot run k
+    static bool setKernel(Kernel k);
+    static bool supports(Kernel k);
+    static const char* kernelName(Kernel k);
+
+    // dab is clipped to dst
+    static void blend(QImage *dst, const QImage &dab, const QPoint &pos);
+    static void blendSpan(quint32 *dst, const quint32 *src, int count);
+
+    // x * a / 255 for each channel of premultiplied pixel x
+    static inline quint32 byteMul(quint32 x, quint32 a)
+    {
+        quint32 t = (x & 0xff00ff) * a;
+        t = (t + ((t >> 8) & 0xff00ff) + 0x800080) >> 8;
+        t &= 0xff00ff;
+        x = ((x >> 8) & 0xff00ff) * a;
+        x = (x + ((x >> 8) & 0xff00ff) + 0x800080);
+        x &= 0xff00ff00;
+        return x | t;
+    }
+};
+
+#endif // DABCOMPOSITOR_H
@@ -3,6 +3,7 @@
 #include <QDebug>
 
 #include "../misc/singleton.h"
+#include "dabcompositor.h"
 
 MaskBased::MaskBased() :
     BasicBrush()
@@ -27,43 +28,31 @@ void MaskBased::makeStencil(QColor color)
     }
 }
 
-void MaskBased::drawPointInternal(const QPoint &p, const QImage &stencil, QPainter *painter)
+void MaskBased::drawPointInternal(const QPoint &p, const QImage &stencil, QPainter *)
 {
-    QImage copied_stencil = stencil.convertToFormat(QImage::Format_ARGB32);
-    bool need_delete = false;
-    if(!painter) {
-        painter = new QPainter;
-        need_delete = true;
-        painter->setRenderHint(QPainter::Antialiasing);
-        painter->begin(surface_->imagePtr());
-//        painter->setOpacity(thickness_/qreal(BrushFeature::LIMIT::THICKNESS_MAX));
+    if(stencil.isNull()){
+        return;
     }
+    // stencil is premultiplied, so masking alpha means scaling every channel
+    QImage masked(stencil.size(), QImage::Format_ARGB32_Premultiplied);
+    int lineLength = stencil.width();
+    int mask_start_x = (p.x()%mask_.width()+mask_.width()) % mask_.width();
+    int mask_start_y = (p.y()%mask_.height()+mask_.height()) % mask_.height();
 
-    int lineLength = copied_stencil.width();
-    QRgb * data = (QRgb *)copied_stencil.bits();
-    int mask_start_x = (p.x()+mask_.width()) % mask_.width();
-    int mask_start_y = (p.y()+mask_.height()) % mask_.height();
-
-    for(int y = 0; y<copied_stencil.height();++y){
+    for(int y = 0; y<stencil.height();++y){
+        const QRgb * src = (const QRgb *)stencil.constScanLine(y);
+        QRgb * dst = (QRgb *)masked.scanLine(y);
+        int mask_y = (mask_start_y + y) % mask_.height();
+        const QRgb * mask_line = (const QRgb *)mask_.constScanLine(mask_y);
         for(int x = 0; x<lineLength;++x) {
             int mask_x = (mask_start_x + x) % mask_.width();
-            int mask_y = (mask_start_y + y) % mask_.height();
-            auto p = data[y*lineLength+x];
-            data[y*lineLength+x] = qRgba(
-                        qRed(p),
-                        qGreen(p),
-                        qBlue(p),
-                        qAlpha(p)*qAlpha(mask_.pixel(mask_x, mask_y))/255);
+            dst[x] = DabCompositor::byteMul(src[x], qAlpha(mask_line[mask_x]));
         }
     }
 
-    painter->drawImage(p.x(), p.y(), copied_stencil);
-
-    if(need_delete) {
-        painter->end();
-        delete painter;
-    }
+    blendDab(masked, p);
 }
+
 QImage MaskBased::mask() const
 {
     return mask_;
@@ -76,7 +65,8 @@ void MaskBased::setMask(const QImage &mask)
         return;
     }
     mask_ = mask.convertToFormat(QImage::Format_ARGB32);
-    makeStencil(color_);
+    stencil_valid_ = false;
+    updateStencil();
 }
 
 AbstractBrush *MaskBased::createBrush()
@@ -52,6 +52,26 @@ void SketchBrush::setSettings(const BrushSettings &settings)
     preparePen();
 }
 
+QVariantMap SketchBrush::state() const
+{
+    auto s = AbstractBrush::state();
+    QVariantList list;
+    for(const QPoint &p: points){
+        list.append(p);
+    }
+    s.insert("points", list);
+    return s;
+}
+
+void SketchBrush::setState(const QVariantMap &state)
+{
+    AbstractBrush::setState(state);
+    points.clear();
+    for(const QVariant &p: state.value("points").toList()){
+        points.append(p.toPoint());
+    }
+}
+
 void SketchBrush::preparePen()
 {
     QColor subColor = color_;
@@ -72,13 +92,13 @@ void SketchBrush::sketch()
         }
         points.pop_front();
 
-        QPainter painter;
-        if(!painter.begin(surface_->imagePtr())){
-            return;
-        }
-        painter.setRenderHint(QPainter::Antialiasing);
-        painter.strokePath(path, sketchPen);
-        painter.end();
+        const int r = sketchPen.width() / 2 + 2;
+        const QRect bound = path.controlPointRect().toAlignedRect()
+                .adjusted(-r, -r, r, r);
+        surface_->paint(bound, [this, &path](QPainter *painter) {
+            painter->setRenderHint(QPainter::Antialiasing);
+            painter->strokePath(path, sketchPen);
+        });
     }
 }
 
@@ -15,6 +15,8 @@ public:
     AbstractBrush* createBrush() Q_DECL_OVERRIDE;
     void setSettings(const BrushSettings &settings) Q_DECL_OVERRIDE;
     BrushSettings defaultSettings() const Q_DECL_OVERRIDE;
+    QVariantMap state() const Q_DECL_OVERRIDE;
+    void setState(const QVariantMap &state) Q_DECL_OVERRIDE;
 protected:
     void preparePen();
     QPen sketchPen;
@@ -7,6 +7,7 @@
 #include <QBitmap>
 #include <QObject>
 #include <QDebug>
+#include <QThreadStorage>
 #include <cmath>
 
 #include "../misc/singleton.h"
@@ -49,6 +50,7 @@ int WaterBased::water() const
 void WaterBased::setWater(int water)
 {
     water_ = qBound<int>(BFL::WATER_MIN, water, BFL::WATER_MAX);
+    settings_applied_ = false;
 }
 int WaterBased::extend() const
 {
@@ -58,6 +60,7 @@ int WaterBased::extend() const
 void WaterBased::setExtend(int extend)
 {
     extend_ = qBound<int>(BFL::EXTEND_MIN, extend, BFL::EXTEND_MAX);
+    settings_applied_ = false;
 }
 int WaterBased::mixin() const
 {
@@ -67,12 +70,15 @@ int WaterBased::mixin() const
 void WaterBased::setMixin(int mixin)
 {
     mixin_ = qBound<int>(BFL::MIXIN_MIN, mixin, BFL::MIXIN_MAX);
+    settings_applied_ = false;
 }
 
-// non-reentrant.
+// one cached mask per thread, since layers may be painted in parallel
+static QThreadStorage<QImage> circle_masks;
+
 static inline QImage circle_mask(const int width)
 {
-    static QImage mask;
+    QImage &mask = circle_masks.localData();
     if(mask.width() != width || mask.isNull()){
         mask = QImage(width, width, QImage::Format_ARGB32_Premultiplied);
         mask.fill(Qt::transparent);
@@ -227,7 +233,7 @@ QColor WaterBased::fetchColor(const QPoint& center) const
     const int delta_width = width_ >>1;
     const QPoint start_point(center - QPoint(delta_width, delta_width));
 
-    QImage square = surface_->imagePtr()->copy(QRect(start_point, QSize(width_, width_)));
+    QImage square = surface_->copy(QRect(start_point, QSize(width_, width_)));
 
     QImage&& mask = circle_mask(square.width());
     QPainter painter;
@@ -279,8 +285,8 @@ void WaterBased::drawPoint(const QPoint &p, qreal )
 
 void WaterBased::drawLineTo(const QPoint &end, qreal presure)
 {
-    if(end.x() > surface_->imageConstPtr()->width() || end.x() < 0
-            || end.y() > surface_->imageConstPtr()->height() || end.y() < 0) {
+    if(end.x() > surface_->size().width() || end.x() < 0
+            || end.y() > surface_->size().height() || end.y() < 0) {
         return;
     }
     const QPoint& start = last_point_;
@@ -308,8 +314,6 @@ void WaterBased::drawLineTo(const QPoint &end, qreal presure)
 
     qreal totalDistance = left_ + distance;
 
-    QPainter painter(surface_->imagePtr());
-    painter.setRenderHint(QPainter::Antialiasing);
     while ( totalDistance >= spacing ) {
         bool l_f_ = false;
         if ( left_ > 0.0 ) {
@@ -345,12 +349,20 @@ void WaterBased::drawLineTo(const QPoint &end, qreal presure)
 
         drawPointInternal(cur_point,
                           stencil_,
-                          &painter);
+                          nullptr);
 
         totalDistance -= spacing;
     }
     left_ = totalDistance;
     last_point_ = end;
+    // stencil_ was made with mingled colors
+    stencil_valid_ = false;
+}
+
+void WaterBased::drawStroke(const QVector<StrokePoint> &points)
+{
+    // our point and line drawing differs from BasicBrush's
+    AbstractBrush::drawStroke(points);
 }
 
 void WaterBased::setSettings(const BrushSettings &settings)
@@ -375,3 +387,18 @@ AbstractBrush *WaterBased::createBrush()
 {
     return new WaterBased;
 }
+
+QVariantMap WaterBased::state() const
+{
+    auto s = BasicBrush::state();
+    s.insert("lastColor", last_color_);
+    s.insert("colorRemain", color_remain_);
+    return s;
+}
+
+void WaterBased::setState(const QVariantMap &state)
+{
+    BasicBrush::setState(state);
+    last_color_ = state.value("lastColor").value<QColor>();
+    color_remain_ = state.value("colorRemain", 255).toInt();
+}
@@ -17,10 +17,13 @@ public:
 
     virtual void drawPoint(const QPoint& p, qreal pressure=1) Q_DECL_OVERRIDE;
     virtual void drawLineTo(const QPoint& end, qreal pressure=1) Q_DECL_OVERRIDE;
+    virtual void drawStroke(const QVector<StrokePoint>& points) Q_DECL_OVERRIDE;
 
     void setSettings(const BrushSettings &settings) Q_DECL_OVERRIDE;
     BrushSettings defaultSettings() const Q_DECL_OVERRIDE;
     AbstractBrush* createBrush() Q_DECL_OVERRIDE;
+    QVariantMap state() const Q_DECL_OVERRIDE;
+    void setState(const QVariantMap &state) Q_DECL_OVERRIDE;
 
 protected:
     int water_;
@@ -1,22 +1,35 @@
 #include "canvasbackend.h"
 #include "misc/singleton.h"
+#include "misc/strokecodec.h"
+#include "misc/packdecoder.h"
 
 #include <QTimerEvent>
 #include <QDateTime>
 #include <QJsonDocument>
+#include <QFileDevice>
 #include <QDebug>
 
 CanvasBackend::CanvasBackend(QObject *parent)
     :QObject(parent),
+      ring_(nullptr),
+      decode_threads_(1),
+      replay_from_(0),
+      replay_to_(-1),
       parse_timer_id_(0),
       archive_loaded_(false),
       is_parsed_signal_sent(false),
       pause_(false),
       fullspeed_replay(false)
 {
-    connect(&raw_parser_, &PackParser::docGenerated,
-            [this](QJsonDocument doc){
-        this->onIncomingData(doc.object());
+    connect(&raw_parser_, &PackParser::newPack,
+            [this](const PackParser::ParserResult &result){
+        if(result.pack_type != PackParser::DATA) {
+            return;
+        }
+        StrokeBatch stroke;
+        if(StrokeCodec::fromData(result.pack_data, stroke)){
+            this->onIncomingStroke(stroke);
+        }
     });
     parse_timer_id_ = this->startTimer(10);
 }
@@ -28,6 +41,27 @@ CanvasBackend::~CanvasBackend()
         killTimer(parse_timer_id_);
 }
 
+void CanvasBackend::setStrokeRing(SpscRing<StrokeBatch> *ring)
+{
+    ring_ = ring;
+}
+
+void CanvasBackend::setDecodeThreads(int threads)
+{
+    decode_threads_ = qMax(1, threads);
+}
+
+void CanvasBackend::setReplayRange(qint64 from, qint64 to)
+{
+    replay_from_ = qMax<qint64>(0, from);
+    replay_to_ = to;
+}
+
+bool CanvasBackend::beforeReplayEnd(qint64 offset) const
+{
+    return replay_to_ < 0 || offset < replay_to_;
+}
+
 void CanvasBackend::pauseParse()
 {
     pause_ = true;
@@ -63,7 +97,16 @@ void CanvasBackend::onDataBlock(const QVariantMap info)
 
 void CanvasBackend::onIncomingData(const QJsonObject& obj)
 {
-    incoming_store_.enqueue(obj);
+    StrokeBatch stroke;
+    if(obj.value("action").toString().toLower() == "block"
+            && StrokeCodec::fromBlock(obj, stroke)){
+        onIncomingStroke(stroke);
+    }
+}
+
+void CanvasBackend::onIncomingStroke(const StrokeBatch &stroke)
+{
+    incoming_store_.enqueue(stroke);
     if(fullspeed_replay && !pause_){
         parseIncoming();
     }
@@ -72,64 +115,151 @@ void CanvasBackend::onIncomingData(const QJsonObject& obj)
 void CanvasBackend::parseIncoming()
 {
     do{
-        auto dataBlock = [this](const QVariantMap& m){
-            QString clientid(m["clientid"].toString());
-            QVariantList list(m["block"].toList());
-            if(list.length() < 1) {
-                return;
+        if(incoming_store_.isEmpty()){
+            break;
+        }
+        if(!ring_){
+            emit remoteDrawStroke(incoming_store_.dequeue());
+            emit blockParsed();
+        }else if(ring_->push(incoming_store_.head())){
+            incoming_store_.dequeue();
+            if(ring_->claimWakeup()){
+                emit strokesQueued();
             }
+        }else{
+            // painter is behind, try again on next tick
+            break;
+        }
+    } while(fullspeed_replay && !pause_);
 
-            QString layerName(m["layer"].toString());
-            QVariantMap brushInfo(m["brush"].toMap());
+    // everything must be handed over before the end is announced
+    if(archive_loaded_ && incoming_store_.isEmpty()
+            && !is_parsed_signal_sent){
+        emit archiveParsed();
+        this->killTimer(parse_timer_id_);
+        is_parsed_signal_sent = true;
+        parse_timer_id_ = 0;
+    }
+}
 
-            // parse first point as drawpoint
-            QVariantMap first_set(list.takeFirst().toMap());
-            QPoint point(first_set.value("x", 0).toInt(), first_set.value("y", 0).toInt());
-            qreal pressure = 1.0;
-            if(first_set.contains("pressure")) {
-                pressure = first_set.value("pressure").toDouble();
-            }
+// Offline replay pulls packs from device and paints them in one tight
+// loop, without timer pacing or queued signals in between.
+// Everything emitted here is delivered directly, so the receivers
+// must live in the same thread as this backend.
+void CanvasBackend::replayOffline(QIODevice &device)
+{
+    if(parse_timer_id_){
+        killTimer(parse_timer_id_);
+        parse_timer_id_ = 0;
+    }
+    if(decode_threads_ > 1){
+        replayDecoded(device);
+        return;
+    }
 
-            emit remoteDrawPoint(point, brushInfo,
-                                 layerName, clientid,
-                                 pressure);
-
-            // parse points as drawlines, with first point as start
-            QPoint start_point(point);
-            QPoint end_point;
-            QVariantMap end;
-            while(list.length()){
-                end = list.takeFirst().toMap();
-                end_point.setX(end.value("x").toInt());
-                end_point.setY(end.value("y").toInt());
-                qreal pressure = 1.0;
-                if(end.contains("pressure")) {
-                    pressure = end.value("pressure").toDouble();
-                }
-
-                emit remoteDrawLine(start_point, end_point,
-                                    brushInfo, layerName,
-                                    clientid, pressure);
-                start_point = end_point;
+    const qint64 total = device.size();
+    StrokeBatch stroke;
+    auto parseData = [this, total, &stroke](const QByteArray &data, qint64 pos){
+        if(StrokeCodec::fromData(data, stroke)){
+            emit remoteDrawStroke(stroke);
+            // position first, a checkpoint taken on blockParsed needs it
+            emit replayProgress(pos, total);
+            emit blockParsed();
+        }
+    };
+
+    // walk a mapped archive in place when possible
+    QFileDevice* file = qobject_cast<QFileDevice*>(&device);
+    if(file && raw_parser_.mapFile(*file)){
+        raw_parser_.setMappedPosition(replay_from_);
+        PackParser::PackView view;
+        while(!pause_ && raw_parser_.nextPack(view)
+              && beforeReplayEnd(view.offset)){
+            if(view.pack_type != PackParser::DATA) {
+                continue;
             }
-        };
-
-        if(incoming_store_.length()){
-            auto obj = incoming_store_.dequeue();
-            QString action = obj.value("action").toString().toLower();
-            if(action == "block"){
-                dataBlock(obj.toVariantMap());
-                emit blockParsed();
+            parseData(QByteArray::fromRawData(view.data, view.size),
+                      raw_parser_.mappedPosition());
+        }
+        raw_parser_.unmapFile();
+    }else{
+        device.seek(replay_from_);
+        PackParser::ParserResult result;
+        while(!pause_ && beforeReplayEnd(device.pos())
+              && raw_parser_.readPack(device, result)){
+            if(result.pack_type != PackParser::DATA) {
+                continue;
             }
+            parseData(result.pack_data, device.pos());
         }
+    }
 
-    } while(fullspeed_replay && !pause_ && incoming_store_.length());
-
-    if(archive_loaded_ && !is_parsed_signal_sent){
+    archive_loaded_ = true;
+    if(!is_parsed_signal_sent){
+        is_parsed_signal_sent = true;
         emit archiveParsed();
-        this->killTimer(parse_timer_id_);
+    }
+}
+
+// replayOffline() with packs inflated and decoded by a PackDecoder,
+// while this thread only reads packs and paints what comes back
+void CanvasBackend::replayDecoded(QIODevice &device)
+{
+    const qint64 total = device.size();
+    PackDecoder decoder(decode_threads_, &StrokeCodec::fromData);
+    QFileDevice* file = qobject_cast<QFileDevice*>(&device);
+    const bool mapped = file && raw_parser_.mapFile(*file);
+    if(mapped){
+        raw_parser_.setMappedPosition(replay_from_);
+    }else{
+        device.seek(replay_from_);
+    }
+
+    // mapped packs go in without a copy, mapping outlives decoder's use
+    auto feed = [&]() -> bool {
+        if(mapped){
+            PackParser::PackView view;
+            if(!raw_parser_.nextRawPack(view) || !beforeReplayEnd(view.offset)){
+                return false;
+            }
+            decoder.submit(QByteArray::fromRawData(view.data, view.size),
+                           raw_parser_.mappedPosition());
+            return true;
+        }
+        QByteArray rawpack;
+        if(!beforeReplayEnd(device.pos())
+                || !PackParser::readRawPack(device, rawpack)){
+            return false;
+        }
+        decoder.submit(rawpack, device.pos());
+        return true;
+    };
+
+    bool more = true;
+    StrokeBatch stroke;
+    qint64 pos = 0;
+    while(!pause_){
+        while(more && !decoder.full()){
+            more = feed();
+        }
+        if(!decoder.next(stroke, pos)){
+            break;
+        }
+        emit remoteDrawStroke(stroke);
+        emit replayProgress(pos, total);
+        emit blockParsed();
+    }
+    // drain before unmapping, workers may still read the mapping
+    while(decoder.next(stroke, pos)){
+    }
+    if(mapped){
+        raw_parser_.unmapFile();
+    }
+
+    archive_loaded_ = true;
+    if(!is_parsed_signal_sent){
         is_parsed_signal_sent = true;
-        parse_timer_id_ = 0;
+        emit archiveParsed();
     }
 }
 
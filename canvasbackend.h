@@ -10,6 +10,8 @@
 #include <QPoint>
 #include <QIODevice>
 #include "misc/packparser.h"
+#include "misc/strokebatch.h"
+#include "misc/spscring.h"
 
 class CanvasBackend : public QObject
 {
@@ -17,13 +19,23 @@ class CanvasBackend : public QObject
 public:
     CanvasBackend(QObject *parent = nullptr);
     ~CanvasBackend();
+    // strokes go to ring instead of remoteDrawStroke() and blockParsed(),
+    // strokesQueued() tells the consumer to pop them. Ring is not owned.
+    void setStrokeRing(SpscRing<StrokeBatch> *ring);
+    // offline replay inflates and decodes packs on this many threads
+    void setDecodeThreads(int threads);
+    // offline replay only plays packs starting in [from, to),
+    // offsets come from an ArchiveIndex and to < 0 means till the end
+    void setReplayRange(qint64 from, qint64 to);
 public slots:
     void onDataBlock(const QVariantMap d);
     void onIncomingData(const QJsonObject &d);
+    void onIncomingStroke(const StrokeBatch &stroke);
     void pauseParse();
     void resumeParse();
     void setInput(QIODevice &device);
     void setFullspeed(bool full);
+    void replayOffline(QIODevice &device);
 signals:
     void newDataGroup(const QByteArray& d);
     void remoteDrawPoint(const QPoint &point,
@@ -37,13 +49,21 @@ signals:
                         const QString &layer,
                         const QString clientid,
                         const qreal pressure=1.0);
+    void remoteDrawStroke(const StrokeBatch &stroke);
+    void strokesQueued();
     void blockParsed();
     void archiveParsed();
+    void replayProgress(qint64 done, qint64 total);
 protected:
     void timerEvent(QTimerEvent * event);
 private:
     PackParser raw_parser_;
-    QQueue<QJsonObject> incoming_store_;
+    QQueue<StrokeBatch> incoming_store_;
+    SpscRing<StrokeBatch> *ring_;
+    int decode_threads_;
+    qint64 replay_from_;
+    qint64 replay_to_;
+    bool beforeReplayEnd(qint64 offset) const;
     int parse_timer_id_;
     bool archive_loaded_;
     bool is_parsed_signal_sent;
@@ -51,6 +71,7 @@ private:
     bool fullspeed_replay;
     QByteArray toJson(const QVariant &m);
     QVariant fromJson(const QByteArray &d);
+    void replayDecoded(QIODevice &device);
 private slots:
     void parseIncoming();
 };
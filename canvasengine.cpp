@@ -8,6 +8,10 @@
 #include <QTimer>
 #include <QTimerEvent>
 #include <QDir>
+#include <QFile>
+#include <QSaveFile>
+#include <QDataStream>
+#include <QStringList>
 #include <QDebug>
 #include <QtCore/qmath.h>
 
@@ -19,6 +23,9 @@
 #include "brush/waterbased.h"
 #include "brush/maskbased.h"
 #include "misc/singleton.h"
+#include "misc/call_once.h"
+#include "misc/layerscheduler.h"
+#include "misc/archiveindex.h"
 
 #define brush_manager Singleton<BrushManager>::instance()
 
@@ -52,33 +59,68 @@ void loadBrush_sub<>()
 {
 }
 
+// strokes parsed ahead of painting, and taken off the ring at once
+static const int STROKE_RING_SIZE = 1024;
+static const int STROKE_POP_SIZE = 64;
+
+static const quint32 checkpoint_magic = 0x50434b50; // "PCKP"
+static const quint8 checkpoint_version = 1;
+
+static QBasicAtomicInt brush_loaded_flag = Q_BASIC_ATOMIC_INITIALIZER(CallOnce::CO_Request);
+
 CanvasEngine::CanvasEngine(const QSize size, QObject *parent) :
     QObject(parent),
     canvasSize(size),
     layers(canvasSize),
-    image(canvasSize, QImage::Format_ARGB32_Premultiplied),
+    composite_(canvasSize, QImage::Format_ARGB32_Premultiplied),
     layerNameCounter(0),
     backend_(new CanvasBackend(0)),
     worker_(new QThread(this)),
-    output_(nullptr)
+    input_(nullptr),
+    output_(nullptr),
+    fullspeed_(false),
+    offline_(false),
+    stroke_count_(0),
+    point_count_(0),
+    dab_count_(0),
+    painters_(nullptr),
+    strokes_(STROKE_RING_SIZE),
+    drained_(STROKE_POP_SIZE),
+    replay_pos_(-1),
+    checkpoint_every_(0),
+    checkpoint_blocks_(0)
 {
     loadBrush();
+    qRegisterMetaType<StrokeBatch>("StrokeBatch");
 
-    worker_->start();
-    backend_->moveToThread(worker_);
+    // backend is moved to worker_ in setInput(), unless we replay offline
     connect(backend_, &CanvasBackend::remoteDrawLine,
             this, &CanvasEngine::remoteDrawLine);
     connect(backend_, &CanvasBackend::remoteDrawPoint,
             this, &CanvasEngine::remoteDrawPoint);
+    connect(backend_, &CanvasBackend::remoteDrawStroke,
+            this, &CanvasEngine::drawStroke);
+    connect(backend_, &CanvasBackend::strokesQueued,
+            this, &CanvasEngine::drainStrokes);
     connect(worker_, &QThread::finished,
             backend_, &CanvasBackend::deleteLater);
     connect(this, &CanvasEngine::parsePaused,
             backend_, &CanvasBackend::pauseParse);
     connect(backend_, &CanvasBackend::blockParsed,
-            this, &CanvasEngine::canvasUpdated);
+            this, &CanvasEngine::onBlockParsed);
+    connect(backend_, &CanvasBackend::replayProgress,
+            this, &CanvasEngine::replayProgress);
+    connect(backend_, &CanvasBackend::replayProgress,
+            this, [this](qint64 done, qint64){
+        replay_pos_ = done;
+    });
+    // use this as context, so the final snapshot is taken in our thread
+    // after every queued drawing call has been delivered
     connect(backend_, &CanvasBackend::archiveParsed,
-            [this](){
+            this, [this](){
         qDebug()<<"archiveParsed";
+        drainStrokes();
+        waitForPainters();
         if(output_){
             this->allCanvas().save(output_, "png");
             output_->close();
@@ -95,26 +137,43 @@ CanvasEngine::CanvasEngine(const QSize size, QObject *parent) :
 CanvasEngine::~CanvasEngine()
 {
     pause();
-    if(worker_){
+    delete painters_;
+    if(worker_->isRunning()){
         worker_->quit();
         worker_->wait();
+    }else{
+        // never moved to worker_, which means it's still ours
+        delete backend_;
     }
     this->disconnect();
 }
 
-QImage CanvasEngine::allCanvas()
+QImage CanvasEngine::allCanvas(QVector<QRect> *changed)
 {
-    QImage exp(canvasSize, QImage::Format_ARGB32_Premultiplied);
-    exp.fill(Qt::white);
-    QPainter painter(&exp);
-    int count = layers.count();
-    QImage * im = 0;
-    for(int i=0;i<count;++i){
-        LayerPointer l = layers.layerFrom(i);
-        im = l->imagePtr();
-        painter.drawImage(0, 0, *im);
+    waitForPainters();
+    const QVector<QRect> dirty = layers.takeDirtyRects();
+    unsent_changes_ += dirty;
+    if(changed){
+        changed->swap(unsent_changes_);
+        unsent_changes_.clear();
     }
-    return exp;
+    if(dirty.isEmpty()){
+        return composite_;
+    }
+    QPainter painter(&composite_);
+    const int count = layers.count();
+    for(const QRect &rect: dirty){
+        painter.fillRect(rect, Qt::white);
+        for(int i=0;i<count;++i){
+            LayerPointer l = layers.layerFrom(i);
+            if(l->isHided()){
+                continue;
+            }
+            l->drawOnto(&painter, rect);
+        }
+    }
+    painter.end();
+    return composite_;
 }
 
 BrushPointer CanvasEngine::brushFactory(const QString &name)
@@ -124,7 +183,222 @@ BrushPointer CanvasEngine::brushFactory(const QString &name)
 
 void CanvasEngine::loadBrush()
 {
-    loadBrush_sub<BasicBrush, BinaryBrush, SketchBrush, BasicEraser, MaskBased>();
+    // BrushManager is shared by every engine in the process
+    qCallOnce([](){
+        loadBrush_sub<BasicBrush, BinaryBrush, SketchBrush, BasicEraser, MaskBased>();
+    }, brush_loaded_flag);
+}
+
+void CanvasEngine::setSnapshotPolicy(SnapshotScheduler::Policy policy,
+                                     qint64 value)
+{
+    scheduler_.setPolicy(policy, value);
+}
+
+void CanvasEngine::setPaintThreads(int threads)
+{
+    delete painters_;
+    painters_ = threads > 1 ? new LayerScheduler(threads) : nullptr;
+}
+
+int CanvasEngine::paintThreads() const
+{
+    return painters_ ? painters_->laneCount() : 1;
+}
+
+void CanvasEngine::setDecodeThreads(int threads)
+{
+    backend_->setDecodeThreads(threads);
+}
+
+void CanvasEngine::setReplayRange(qint64 from, qint64 to)
+{
+    backend_->setReplayRange(from, to);
+}
+
+void CanvasEngine::waitForPainters()
+{
+    if(painters_){
+        painters_->barrier();
+    }
+}
+
+quint64 CanvasEngine::dabCount()
+{
+    waitForPainters();
+    dab_count_ += layers.takeDabCount();
+    return dab_count_;
+}
+
+void CanvasEngine::onBlockParsed()
+{
+    emit canvasUpdated();
+    // with painters_ dabs still being painted would be counted on a later
+    // block, which depends on thread timing; only EVERY_DABS needs them
+    // exact, the others can let lanes run on
+    if(scheduler_.policy() == SnapshotScheduler::EVERY_DABS){
+        waitForPainters();
+    }
+    dab_count_ += layers.takeDabCount();
+    if(scheduler_.blockDone(dab_count_)){
+        emit snapshotDue();
+    }
+    if(checkpoint_every_ > 0 && replay_pos_ >= 0
+            && ++checkpoint_blocks_ >= checkpoint_every_){
+        checkpoint_blocks_ = 0;
+        const QString fileName = QDir(checkpoint_dir_).filePath(
+                    QString("%1.ckpt").arg(replay_pos_));
+        if(saveCheckpoint(fileName, replay_pos_)){
+            emit checkpointSaved(replay_pos_, fileName);
+        }
+    }
+}
+
+bool CanvasEngine::replayUntil(const ArchiveIndex &index, int pack)
+{
+    qint64 from = 0;
+    const ArchiveIndex::Checkpoint *checkpoint = index.checkpointBefore(pack);
+    if(checkpoint){
+        if(!loadCheckpoint(checkpoint->file, &from)){
+            return false;
+        }
+        qDebug()<<"replay goes on from"<<checkpoint->file;
+    }
+    setReplayRange(from, pack < index.count() ? index.offset(pack) : -1);
+    return true;
+}
+
+void CanvasEngine::setCheckpointing(int blocks, const QString &dir)
+{
+    checkpoint_every_ = blocks;
+    checkpoint_blocks_ = 0;
+    checkpoint_dir_ = dir;
+    if(blocks > 0){
+        QDir().mkpath(dir);
+    }
+}
+
+// QDataStream of magic, version, canvas size, offset, counters,
+// layers bottom up as name and Layer::save(), then client brushes
+// as client id, brush name and AbstractBrush::state()
+bool CanvasEngine::saveCheckpoint(const QString &fileName, qint64 offset)
+{
+    waitForPainters();
+    QSaveFile file(fileName);
+    if(!file.open(QIODevice::WriteOnly)){
+        qWarning()<<"cannot write checkpoint"<<fileName;
+        return false;
+    }
+    QDataStream out(&file);
+    out<<checkpoint_magic<<checkpoint_version<<canvasSize<<offset
+      <<stroke_count_<<point_count_<<dab_count_<<qint32(layerNameCounter);
+    out<<qint32(layers.count());
+    for(int i=0;i<layers.count();++i){
+        LayerPointer l = layers.layerFrom(i);
+        out<<l->name();
+        l->save(out);
+    }
+    out<<qint32(remoteBrush.count());
+    for(auto it = remoteBrush.constBegin();it != remoteBrush.constEnd();++it){
+        out<<it.key()<<it.value()->name().toLower()<<it.value()->state();
+    }
+    // a crash while writing leaves the previous file alone
+    return out.status() == QDataStream::Ok && file.commit();
+}
+
+bool CanvasEngine::loadCheckpoint(const QString &fileName, qint64 *offset)
+{
+    waitForPainters();
+    QFile file(fileName);
+    if(!file.open(QIODevice::ReadOnly)){
+        qWarning()<<"cannot open checkpoint"<<fileName;
+        return false;
+    }
+    QDataStream in(&file);
+    quint32 magic;
+    quint8 version;
+    QSize size;
+    in>>magic>>version>>size;
+    if(magic != checkpoint_magic || version != checkpoint_version
+            || size != canvasSize){
+        qWarning()<<"checkpoint does not fit"<<fileName;
+        return false;
+    }
+    // everything is read before any of it is used, so a short or corrupt
+    // file leaves the engine as it was
+    qint64 from;
+    quint64 strokes;
+    quint64 points;
+    quint64 dabs;
+    qint32 counter;
+    in>>from>>strokes>>points>>dabs>>counter;
+
+    QStringList names;
+    QList<LayerPointer> loaded;
+    qint32 count;
+    in>>count;
+    for(int i=0;i<count && in.status() == QDataStream::Ok;++i){
+        QString name;
+        in>>name;
+        LayerPointer l(new Layer(name, canvasSize));
+        if(names.contains(name) || !l->load(in)){
+            qWarning()<<"bad layer in checkpoint"<<fileName;
+            return false;
+        }
+        names.append(name);
+        loaded.append(l);
+    }
+
+    struct ClientBrush
+    {
+        QString clientid;
+        QString name;
+        QVariantMap state;
+    };
+    QList<ClientBrush> brushes;
+    in>>count;
+    for(int i=0;i<count && in.status() == QDataStream::Ok;++i){
+        ClientBrush b;
+        in>>b.clientid>>b.name>>b.state;
+        brushes.append(b);
+    }
+    if(in.status() != QDataStream::Ok){
+        qWarning()<<"checkpoint is cut short"<<fileName;
+        return false;
+    }
+
+    while(layers.count()){
+        LayerPointer l = layers.layerFrom(0);
+        l->unlock();
+        layers.removeLayer(l->name());
+    }
+    for(int i=0;i<loaded.count();++i){
+        layers.appendLayer(loaded[i], names[i]);
+    }
+    remoteBrush.clear();
+    for(const ClientBrush &b: brushes){
+        clientBrush(b.clientid, b.name)->setState(b.state);
+    }
+    layerNameCounter = counter;
+    stroke_count_ = strokes;
+    point_count_ = points;
+    dab_count_ = dabs;
+    *offset = from;
+    replay_pos_ = from;
+    return true;
+}
+
+void CanvasEngine::drainStrokes()
+{
+    strokes_.wakeupHandled();
+    int n;
+    while((n = strokes_.pop(drained_.data(), drained_.count())) > 0){
+        for(int i=0;i<n;++i){
+            drawStroke(drained_[i]);
+            drained_[i] = StrokeBatch();
+            onBlockParsed();
+        }
+    }
 }
 
 bool CanvasEngine::fullspeed() const
@@ -132,6 +406,16 @@ bool CanvasEngine::fullspeed() const
     return fullspeed_;
 }
 
+bool CanvasEngine::offline() const
+{
+    return offline_;
+}
+
+void CanvasEngine::setOffline(bool offline)
+{
+    offline_ = offline;
+}
+
 void CanvasEngine::setFullspeed(bool fullspeed)
 {
     fullspeed_ = fullspeed;
@@ -184,10 +468,36 @@ void CanvasEngine::pause()
 
 void CanvasEngine::setInput(QIODevice &device)
 {
+    input_ = &device;
+    scheduler_.reset();
+    if(scheduler_.policy() == SnapshotScheduler::TARGET_FRAMES){
+        scheduler_.setTotalBlocks(PackParser::countPacks(device,
+                                                         PackParser::DATA));
+    }
+    if(offline_){
+        // start after caller enters event loop, so it can catch parseEnded
+        this->metaObject()->invokeMethod(this,
+                                         "replayOffline",
+                                         Qt::QueuedConnection);
+        return;
+    }
+    // live replay crosses threads, so strokes go through the ring
+    backend_->setStrokeRing(&strokes_);
+    worker_->start();
+    backend_->moveToThread(worker_);
     this->backend_->setInput(device);
 //    timer_ = this->startTimer(300);
 }
 
+void CanvasEngine::replayOffline()
+{
+    if(!input_){
+        return;
+    }
+    // backend shares our thread, so it paints via direct calls
+    backend_->replayOffline(*input_);
+}
+
 void CanvasEngine::setOutput(QIODevice &device)
 {
     output_ = &device;
@@ -200,7 +510,11 @@ void CanvasEngine::remoteDrawPoint(const QPoint &point,
                                    const qreal pressure)
 {
     if(!layers.exists(layer)) return;
+    // client's brush may still be in use by painters_
+    waitForPainters();
     LayerPointer l = layers.layerFrom(layer);
+    ++stroke_count_;
+    ++point_count_;
 
     QVariantMap cpd_brushInfo = brushInfo;
     QString brushName = cpd_brushInfo["name"].toString().toLower();
@@ -212,20 +526,20 @@ void CanvasEngine::remoteDrawPoint(const QPoint &point,
         if(brushName != t->name().toLower()){
             BrushPointer newOne = brushFactory(brushName);
             newOne->setSurface(l);
-            newOne->setSettings(cpd_brushInfo);
+            newOne->applySettings(cpd_brushInfo);
             newOne->drawPoint(point, pressure);
             remoteBrush[clientid] = newOne;
             //            t.clear();
         }else{
             BrushPointer original = remoteBrush[clientid];
             original->setSurface(l);
-            original->setSettings(cpd_brushInfo);
+            original->applySettings(cpd_brushInfo);
             original->drawPoint(point, pressure);
         }
     }else{
         BrushPointer newOne = brushFactory(brushName);
         newOne->setSurface(l);
-        newOne->setSettings(cpd_brushInfo);
+        newOne->applySettings(cpd_brushInfo);
         newOne->drawPoint(point, pressure);
         remoteBrush[clientid] = newOne;
     }
@@ -241,7 +555,9 @@ void CanvasEngine::remoteDrawLine(const QPoint &, const QPoint &end,
     if(!layers.exists(layer)){
         return;
     }
+    waitForPainters();
     LayerPointer l = layers.layerFrom(layer);
+    ++point_count_;
 
     QVariantMap cpd_brushInfo = brushInfo;
     QString brushName = cpd_brushInfo["name"].toString().toLower();
@@ -251,26 +567,71 @@ void CanvasEngine::remoteDrawLine(const QPoint &, const QPoint &end,
         if(brushName != t->name().toLower()){
             BrushPointer newOne = brushFactory(brushName);
             newOne->setSurface(l);
-            newOne->setSettings(cpd_brushInfo);
+            newOne->applySettings(cpd_brushInfo);
             newOne->drawLineTo(end, pressure);
             remoteBrush[clientid] = newOne;
             //            t.clear();
         }else{
             BrushPointer original = remoteBrush[clientid];
             original->setSurface(l);
-            original->setSettings(cpd_brushInfo);
+            original->applySettings(cpd_brushInfo);
             original->drawLineTo(end, pressure);
         }
     }else{
         BrushPointer newOne = brushFactory(brushName);
         newOne->setSurface(l);
-        newOne->setSettings(cpd_brushInfo);
+        newOne->applySettings(cpd_brushInfo);
         qDebug()<<"warning, remote drawing starts with line drawing";
         newOne->drawLineTo(end, pressure);
         remoteBrush[clientid] = newOne;
     }
 }
 
+// the brush client is painting with, a new one is made if client
+// has none yet or switched to another kind of brush
+BrushPointer CanvasEngine::clientBrush(const QString &clientid,
+                                       const QString &brushName)
+{
+    BrushPointer brush = remoteBrush.value(clientid);
+    if(brush.isNull() || brushName != brush->name().toLower()){
+        brush = brushFactory(brushName);
+        remoteBrush[clientid] = brush;
+    }
+    return brush;
+}
+
+// a whole block is drawn in one go, with brush settings applied once.
+// With painters_ it's drawn on the layer's lane, task holds its own
+// references so the brush or layer may be replaced meanwhile.
+void CanvasEngine::drawStroke(const StrokeBatch &stroke)
+{
+    if(stroke.points.isEmpty() || !layers.exists(stroke.layer)){
+        return;
+    }
+    LayerPointer l = layers.layerFrom(stroke.layer);
+    ++stroke_count_;
+    point_count_ += stroke.points.count();
+
+    QVariantMap cpd_brushInfo = stroke.brush;
+    QString brushName = cpd_brushInfo["name"].toString().toLower();
+    cpd_brushInfo.remove("name"); // remove useless info
+
+    BrushPointer brush = clientBrush(stroke.clientid, brushName);
+    auto paint = [brush, l, cpd_brushInfo](const QVector<StrokePoint> &points){
+        brush->setSurface(l);
+        brush->applySettings(cpd_brushInfo);
+        brush->drawStroke(points);
+    };
+    if(!painters_){
+        paint(stroke.points);
+        return;
+    }
+    const QVector<StrokePoint> points = stroke.points;
+    painters_->submit(stroke.layer, stroke.clientid, [paint, points](){
+        paint(points);
+    });
+}
+
 /* Layer */
 
 QString CanvasEngine::currentLayer()
@@ -5,6 +5,11 @@
 #include "brush/abstractbrush.h"
 #include "misc/layermanager.h"
 #include "canvasbackend.h"
+#include "misc/snapshotscheduler.h"
+#include "misc/spscring.h"
+
+class LayerScheduler;
+class ArchiveIndex;
 
 typedef QSharedPointer<AbstractBrush> BrushPointer;
 
@@ -19,8 +24,41 @@ public:
     QString currentLayer();
     int count() const{return layers.count();}
     int layerNum() const{return layerNameCounter;}
-    QImage allCanvas();
+    // changed gets what was redrawn since the last call asking for it
+    QImage allCanvas(QVector<QRect> *changed = nullptr);
     bool fullspeed() const;
+    bool offline() const;
+    quint64 strokeCount() const{return stroke_count_;}
+    quint64 pointCount() const{return point_count_;}
+    // waits for painters, so dabs of every stroke drawn so far are in
+    quint64 dabCount();
+    quint64 snapshotCount() const{return scheduler_.snapshots();}
+    // must be set before setInput()
+    void setSnapshotPolicy(SnapshotScheduler::Policy policy, qint64 value);
+    // strokes are painted on threads this many layers at a time,
+    // 1 paints them in engine's own thread
+    void setPaintThreads(int threads);
+    int paintThreads() const;
+    // threads inflating and decoding packs in offline replay,
+    // must be set before setInput()
+    void setDecodeThreads(int threads);
+    // offline replay plays only packs starting in [from, to), see
+    // ArchiveIndex::offset(); must be set before setInput()
+    void setReplayRange(qint64 from, qint64 to = -1);
+
+    // Checkpoint is every layer's touched tiles, each client's brush
+    // state and the archive offset replay goes on from. Offline replay
+    // writes one to dir every blocks blocks, named <offset>.ckpt.
+    void setCheckpointing(int blocks, const QString &dir);
+    bool saveCheckpoint(const QString &fileName, qint64 offset);
+    // offset gets where replay should go on
+    bool loadCheckpoint(const QString &fileName, qint64 *offset);
+    // offline replay stops before pack, and starts from the latest
+    // checkpoint at or before it; must be called before setInput()
+    bool replayUntil(const ArchiveIndex &index, int pack);
+    // strokes handed over by parser thread but not painted yet
+    int strokeQueueDepth() const{return strokes_.depth();}
+    int strokeQueueHighWatermark() const{return strokes_.highWatermark();}
 
 public slots:
     void addLayer(const QString &name);
@@ -31,12 +69,22 @@ public slots:
     void setInput(QIODevice& device);
     void setOutput(QIODevice& device);
     void setFullspeed(bool fullspeed);
+    // must be set before setInput()
+    void setOffline(bool offline);
+    void drawStroke(const StrokeBatch &stroke);
 
 signals:
     void parsePaused();
     void parseEnded();
     void canvasUpdated();
+    // scheduler thinks canvas should go to video now
+    void snapshotDue();
+    void replayProgress(qint64 done, qint64 total);
+    void checkpointSaved(qint64 offset, const QString &fileName);
 private slots:
+    void replayOffline();
+    void onBlockParsed();
+    void drainStrokes();
     void remoteDrawPoint(const QPoint &point,
                          const QVariantMap &brushSettings,
                          const QString &layer,
@@ -53,17 +101,34 @@ private:
     void drawLineTo(const QPoint &endPoint, qreal pressure=1.0);
     void drawPoint(const QPoint &point, qreal pressure=1.0);
     BrushPointer brushFactory(const QString &name);
+    BrushPointer clientBrush(const QString &clientid, const QString &brushName);
     void loadBrush();
+    void waitForPainters();
 
     QSize canvasSize;
     LayerManager layers;
-    QImage image;
+    // kept between snapshots, only dirty parts are composited again
+    QImage composite_;
+    QVector<QRect> unsent_changes_;
     int layerNameCounter;
     QHash<QString, BrushPointer> remoteBrush;
     CanvasBackend* backend_;
     QThread *worker_;
+    QIODevice *input_;
     QIODevice *output_;
     bool fullspeed_;
+    bool offline_;
+    quint64 stroke_count_;
+    quint64 point_count_;
+    quint64 dab_count_;
+    SnapshotScheduler scheduler_;
+    LayerScheduler *painters_;
+    SpscRing<StrokeBatch> strokes_;
+    QVector<StrokeBatch> drained_;
+    qint64 replay_pos_;     // where next pack starts, -1 if unknown
+    int checkpoint_every_;
+    int checkpoint_blocks_;
+    QString checkpoint_dir_;
 };
 
 
@@ -16,79 +16,289 @@ extern "C" {
 
 
 #include <QImage>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QWaitCondition>
+#include <QQueue>
+#include <QVector>
+#include <QRect>
+#include <QThread>
+#include <QHash>
+#include <QStringList>
 #include <QDebug>
 
+#include "../misc/call_once.h"
+#include "yuvconvert.h"
+
 static const int fps = 30;
 
+static int lock_manager(void **mutex, enum AVLockOp op)
+{
+    switch(op){
+    case AV_LOCK_CREATE:
+        *mutex = new QMutex;
+        return 0;
+    case AV_LOCK_OBTAIN:
+        static_cast<QMutex*>(*mutex)->lock();
+        return 0;
+    case AV_LOCK_RELEASE:
+        static_cast<QMutex*>(*mutex)->unlock();
+        return 0;
+    case AV_LOCK_DESTROY:
+        delete static_cast<QMutex*>(*mutex);
+        *mutex = nullptr;
+        return 0;
+    }
+    return 1;
+}
+
+static QBasicAtomicInt register_flag = Q_BASIC_ATOMIC_INITIALIZER(CallOnce::CO_Request);
+
+static void register_codecs()
+{
+    avcodec_register_all();
+    av_register_all();
+    // avcodec_open2 is not reentrant, and several encoders may be
+    // opened at the same time in batch mode
+    av_lockmgr_register(lock_manager);
+}
+
+// Converts to YUV420P and scales in the same sws_scale() call.
+// Same sized RGB input skips swscale, YuvConvert does it row-parallel.
 class ImageConvert
 {
 public:
-    ImageConvert(const QSize &size)
+    ImageConvert(const QSize &src, AVPixelFormat srcFormat,
+                 const QSize &dst, int flags, int threads = 1)
+        :src_(src),
+          src_format_(srcFormat),
+          dst_(dst),
+          flags_(flags),
+          threads_(threads),
+          ctx_(NULL)
     {
-        ctx = sws_getContext(size.width(),
-                              size.height(),
-                              AV_PIX_FMT_RGB32,
-                              size.width(),
-                              size.height(),
+        if(src == dst && srcFormat == AV_PIX_FMT_RGB32){
+            return;
+        }
+        ctx_ = sws_getContext(src.width(),
+                              src.height(),
+                              srcFormat,
+                              dst.width(),
+                              dst.height(),
                               AV_PIX_FMT_YUV420P,
-                              0, 0, 0, 0);
+                              flags, 0, 0, 0);
     }
 
     ~ImageConvert()
     {
-        sws_freeContext(ctx);
+        sws_freeContext(ctx_);
+    }
+
+    bool matches(const QSize &src, AVPixelFormat srcFormat,
+                 const QSize &dst, int flags, int threads) const
+    {
+        return src == src_ && srcFormat == src_format_ && dst == dst_
+                && flags == flags_ && threads == threads_;
+    }
+
+    // only changed parts are converted if image is not scaled
+    void convert(const QImage &image, AVFrame* frame,
+                 const QVector<QRect> &changed)
+    {
+        if(ctx_){
+            convert(image, frame);
+            return;
+        }
+        for(const QRect &r: changed){
+            const QRect area = macroblocks(r);
+            if(area.isEmpty()){
+                continue;
+            }
+            uchar *planes[3] = {
+                frame->data[0] + area.y() * frame->linesize[0] + area.x(),
+                frame->data[1] + (area.y() / 2) * frame->linesize[1] + area.x() / 2,
+                frame->data[2] + (area.y() / 2) * frame->linesize[2] + area.x() / 2
+            };
+            YuvConvert::convert(image.constScanLine(area.y()) + area.x() * 4,
+                                image.bytesPerLine(),
+                                area.width(), area.height(),
+                                planes, frame->linesize, threads_);
+        }
     }
 
     void convert(const QImage &image, AVFrame* frame)
     {
-        uint8_t * inData[1] = { (uint8_t*)image.constBits() }; // RGB have one plane
-        int inLinesize[1] = { 4*image.width() }; // RGB stride
-        sws_scale(ctx, inData, inLinesize, 0, image.height(),
+        if(!ctx_){
+            // composites are opaque, premultiplied makes no difference
+            YuvConvert::convert(image.constBits(), image.bytesPerLine(),
+                                src_.width(), src_.height(),
+                                frame->data, frame->linesize, threads_);
+            return;
+        }
+        // RGB have one plane
+        const uint8_t * inData[1] = { image.constBits() };
+        int inLinesize[1] = { image.bytesPerLine() };
+        sws_scale(ctx_, inData, inLinesize, 0, src_.height(),
+                  frame->data, frame->linesize);
+    }
+
+    // from another YUV420P frame
+    void convert(const AVFrame *src, AVFrame* frame)
+    {
+        sws_scale(ctx_, src->data, src->linesize, 0, src_.height(),
                   frame->data, frame->linesize);
     }
 private:
-    SwsContext * ctx;
+    // 16x16 aligned, so that chroma and codec blocks are never split
+    QRect macroblocks(const QRect &r) const
+    {
+        const int left = r.left() & ~15;
+        const int top = r.top() & ~15;
+        const int right = (r.right() | 15);
+        const int bottom = (r.bottom() | 15);
+        return QRect(QPoint(left, top), QPoint(right, bottom))
+                & QRect(QPoint(0, 0), src_);
+    }
+
+    QSize src_;
+    AVPixelFormat src_format_;
+    QSize dst_;
+    int flags_;
+    int threads_;
+    SwsContext * ctx_;
 };
 
-Encoder::Encoder(const QSize &s, const QString &n, const QString &config) :
-    base_size(s),
-    name(n),
-    converter(new ImageConvert(s))
+// One output size. Frame and converter are kept between output files,
+// codec context and format belong to the file opened last.
+class Rendition
 {
-    int ret = 0;
-    avcodec_register_all();
-    av_register_all();
-    codec = NULL;
+public:
+    Rendition(const QSize &size, int scaleFlags)
+        :size(size),
+          scale_flags(scaleFlags),
+          converter(nullptr),
+          codec(NULL),
+          context(NULL),
+          frame(NULL),
+          format(NULL),
+          d(NULL),
+          stream(NULL),
+          frame_count(0),
+          primed(false),
+          tail(0)
+    {
+        frame = av_frame_alloc();
+        if (!frame) {
+            qDebug()<<"Could not allocate video frame";
+            return;
+        }
+        frame->format = AV_PIX_FMT_YUV420P;
+        frame->width  = size.width();
+        frame->height = size.height();
+        /* the image can be allocated by any means and av_image_alloc() is
+         * just the most convenient way if av_malloc() is to be used */
+        av_image_alloc(frame->data, frame->linesize,
+                       size.width(), size.height(),
+                       AV_PIX_FMT_YUV420P, 32);
+    }
+
+    ~Rendition()
+    {
+        close();
+        if(frame){
+            av_freep(&frame->data[0]);
+            av_frame_free(&frame);
+        }
+        delete converter;
+    }
+
+    bool open(const QString &name, const QString &config);
+    bool isOpen() const{return format;}
+    void encode(int repeat);
+    // frame is unchanged, let the last one last longer
+    void skip(int repeat);
+    void flush();
+    // frees what open() made, without writing anything
+    void close();
+
+    QSize size;
+    QString name;
+    int scale_flags;
+    ImageConvert* converter;
+    AVCodec* codec;
+    AVCodecContext* context;
+    AVFrame* frame;
+    AVFormatContext* format;
+    AVDictionary *d;
+    AVStream *stream;
+    int frame_count;
+    // frames in flight, pts -> duration in codec time base
+    QHash<qint64, int> durations;
+    // frame holds a whole image, partial updates are fine from now on
+    bool primed;
+    // seconds skipped since last encoded frame
+    int tail;
+private:
+    void writePacket(AVPacket *pkt);
+};
+
+void Rendition::close()
+{
+    if(context){
+        avcodec_close(context);
+    }
+    // once attached, stream owns context and frees it with format;
+    // open() may have failed before that
+    if(!stream || stream->codec != context){
+        av_free(context);
+    }
+    if(format){
+        if(format->pb){
+            avio_close(format->pb);
+        }
+        avformat_free_context(format);
+    }
+    av_dict_free(&d);
     context = NULL;
-    frame = NULL;
-    codec = avcodec_find_encoder(AV_CODEC_ID_H264);
-    format = avformat_alloc_context();
-    format->oformat = av_guess_format("mkv", n.toStdString().c_str(), NULL);
-    if (!format->oformat) {
-        qDebug()<<"cannot output mkv, use mpeg instead";
-        format->oformat = av_guess_format("mpeg", NULL, NULL);
+    format = NULL;
+    stream = NULL;
+    frame_count = 0;
+    durations.clear();
+    primed = false;
+    tail = 0;
+}
+
+bool Rendition::open(const QString &name, const QString &config)
+{
+    close();
+    this->name = name;
+    if(!frame || !frame->data[0]){
+        return false;
+    }
+    int ret = 0;
+    if(!codec){
+        codec = avcodec_find_encoder(AV_CODEC_ID_H264);
     }
-    format->video_codec_id = format->oformat->video_codec;
     if(!codec){
         qDebug()<<"cannot find encoder";
-        return;
+        return false;
     }
     qDebug()<<"encoder found";
 
     context = avcodec_alloc_context3(codec);
     if(!context){
         qDebug()<<"cannot alloc context";
-        return;
+        return false;
     }
     qDebug()<<"context allocted";
 
     context->bit_rate = 600000;
     // resolution must be a multiple of two
-    context->width = base_size.width();
-    context->height = base_size.height();
+    context->width = size.width();
+    context->height = size.height();
     // frames per second
     context->time_base= (AVRational){1,fps};
-    context->gop_size = 5; // emit one intra frame every twelve frames at most
+    context->gop_size = 5; // one intra frame every five snapshots at most
     context->max_b_frames = 0; // FIXME: will flash if too large
     context->pix_fmt = AV_PIX_FMT_YUV420P;
 //    context->b_frame_strategy = 1;
@@ -99,7 +309,18 @@ Encoder::Encoder(const QSize &s, const QString &n, const QString &config) :
     context->refs = 2;
     qDebug()<<"context init";
 
-    d = NULL;
+    format = avformat_alloc_context();
+    format->oformat = av_guess_format("mkv", name.toStdString().c_str(), NULL);
+    if (!format->oformat) {
+        qDebug()<<"cannot output mkv, use mpeg instead";
+        format->oformat = av_guess_format("mpeg", NULL, NULL);
+    }
+    format->video_codec_id = format->oformat->video_codec;
+    // must be known before codec is opened
+    if(format->oformat->flags & AVFMT_GLOBALHEADER) {
+       context->flags |= CODEC_FLAG_GLOBAL_HEADER;
+    }
+
 //    av_dict_set( &d, "preset", "slow", 0 );
     qDebug()<<av_set_options_string(context, config.toStdString().c_str(), "=", "\n ");
 
@@ -107,116 +328,98 @@ Encoder::Encoder(const QSize &s, const QString &n, const QString &config) :
     if ( ret < 0) {
         fflush(stderr);
         qDebug()<<"cannot open codec"<<ret;
-        return;
+        return false;
     }
     qDebug()<<"codec open";
 
-    frame = av_frame_alloc();
-    if (!frame) {
-        qDebug()<<"Could not allocate video frame";
-        return;
-    }
-    qDebug()<<"frame allocated";
-
-    frame->format = context->pix_fmt;
-    frame->width  = context->width;
-    frame->height = context->height;
-
-
-    /* the image can be allocated by any means and av_image_alloc() is
-     * just the most convenient way if av_malloc() is to be used */
-    ret = av_image_alloc(frame->data, frame->linesize,
-                         context->width, context->height,
-                         context->pix_fmt, 32);
-    qDebug()<<"image allocated";
-
-    frame_count = 0;
-
     stream = avformat_new_stream(format, codec);
     if(!stream) {
        printf("Could not allocate stream\n");
+       return false;
     }
+    // stream comes with a codec context of its own, free it before
+    // ours takes its place, or every reopen leaks one
+#if LIBAVCODEC_VERSION_INT >= AV_VERSION_INT(55, 69, 100)
+    avcodec_free_context(&stream->codec);
+#else
+    avcodec_close(stream->codec);
+    av_freep(&stream->codec);
+#endif
     stream->codec = context;
 
-    if(format->oformat->flags & AVFMT_GLOBALHEADER) {
-       context->flags |= CODEC_FLAG_GLOBAL_HEADER;
-    }
-
     qDebug()<<name.toStdString().c_str();
-    avio_open(&format->pb,
-              name.toStdString().c_str(),
-              AVIO_FLAG_WRITE);
+    if(avio_open(&format->pb,
+                 name.toStdString().c_str(),
+                 AVIO_FLAG_WRITE) < 0){
+        qDebug()<<"cannot open"<<name;
+        return false;
+    }
     avformat_write_header(format, &d);
+    return true;
 }
 
-Encoder::~Encoder()
+// frame must be converted already
+void Rendition::encode(int repeat)
 {
-    avcodec_close(context);
-    av_free(context);
-    av_freep(&frame->data[0]);
-    av_frame_free(&frame);
-    avformat_free_context(format);
-    av_dict_free(&d);
-    avio_close(format->pb);
-    delete converter;
-}
-
-void Encoder::onImage(const QImage &img)
-{
-    if(img.isNull()) {
-        qDebug()<<"Error input image";
-        return;
-    }
     int got_output = 0;
     int ret = 0;
 
-    for(int i=0;i<fps;++i) {
-        /* encode x second of video */
-        AVPacket pkt;
-        av_init_packet(&pkt);
-        pkt.data = NULL;    // packet data will be allocated by the encoder
-        pkt.size = 0;
-        fflush(stdout);
-
-        converter->convert(img, frame);
-
-        int pts = frame_count;
-
-        frame->pts = pts;
-
-        frame_count++;
-        /* encode the image */
-        ret = avcodec_encode_video2(context, &pkt, frame, &got_output);
-        if (ret < 0) {
-            qDebug()<<"Error encoding frame";
-            return;
-        }
-        if (got_output) {
-            printf("Write frame %3d (size=%5d)\n", frame_count, pkt.size);
-
-            context->coded_frame->pts = pts;  // Set the time stamp
+    AVPacket pkt;
+    av_init_packet(&pkt);
+    pkt.data = NULL;    // packet data will be allocated by the encoder
+    pkt.size = 0;
 
-            if (context->coded_frame->pts != AV_NOPTS_VALUE)
-            {
-                pts = av_rescale_q(context->coded_frame->pts,
-                                           context->time_base,
-                                           format->streams[0]->time_base);
-            }
-            pkt.pts = pts;
+    // one frame holds the image for repeat seconds, the pts gap tells
+    // the muxer how long it lasts
+    frame->pts = frame_count;
+    durations.insert(frame_count, fps*repeat);
+    frame_count += fps*repeat;
+    tail = 0;
 
-            if(context->coded_frame->key_frame)
-            {
-               pkt.flags |= AV_PKT_FLAG_KEY;
-            }
+    ret = avcodec_encode_video2(context, &pkt, frame, &got_output);
+    if (ret < 0) {
+        qDebug()<<"Error encoding frame";
+        return;
+    }
+    if (got_output) {
+        writePacket(&pkt);
+    }
+}
 
-            av_interleaved_write_frame(format, &pkt);
-            av_free_packet(&pkt);
-        }
+// pts from encoder is in codec time base, may be delayed by some frames
+void Rendition::writePacket(AVPacket *pkt)
+{
+    printf("Write frame %3d (size=%5d)\n", int(pkt->pts), pkt->size);
+    const AVRational stream_base = format->streams[0]->time_base;
+    if (pkt->pts != AV_NOPTS_VALUE) {
+        pkt->duration = av_rescale_q(durations.take(pkt->pts),
+                                     context->time_base, stream_base);
+        pkt->pts = av_rescale_q(pkt->pts, context->time_base, stream_base);
     }
+    if (pkt->dts != AV_NOPTS_VALUE) {
+        pkt->dts = av_rescale_q(pkt->dts, context->time_base, stream_base);
+    }
+    if (context->coded_frame->key_frame) {
+        pkt->flags |= AV_PKT_FLAG_KEY;
+    }
+    av_interleaved_write_frame(format, pkt);
+    av_free_packet(pkt);
 }
 
-void Encoder::finish()
+void Rendition::skip(int repeat)
 {
+    frame_count += fps*repeat;
+    tail += repeat;
+}
+
+void Rendition::flush()
+{
+    // show last image again, or video ends before skipped frames
+    if(tail){
+        frame_count -= fps*tail;
+        encode(tail);
+    }
+
     int ret = 0;
     AVPacket pkt;
     av_init_packet(&pkt);
@@ -232,12 +435,451 @@ void Encoder::finish()
             break;
         }
         if (got_output) {
-            printf("Write frame %3d (size=%5d)\n", frame_count, pkt.size);
-            frame_count++;
-            av_interleaved_write_frame(format, &pkt);
+            writePacket(&pkt);
         }
-        av_free_packet(&pkt);
     }
     av_write_trailer(format);
 }
 
+struct EncodeItem
+{
+    QImage image;
+    int repeat;
+    QVector<QRect> changed;
+};
+
+class EncodeThread : public QThread
+{
+public:
+    EncodeThread(Encoder *encoder)
+        :encoder_(encoder),
+          depth_(4),
+          policy_(Encoder::BLOCK),
+          stopping_(false),
+          dropped_(0),
+          coalesced_(0)
+    {
+    }
+
+    void setQueue(int depth, Encoder::QueuePolicy policy)
+    {
+        QMutexLocker locker(&mutex_);
+        depth_ = qMax(1, depth);
+        policy_ = policy;
+    }
+
+    void push(const QImage &image, const QVector<QRect> &changed)
+    {
+        QMutexLocker locker(&mutex_);
+        if(queue_.count() >= depth_){
+            switch(policy_){
+            case Encoder::DROP:
+                // next image must still redo what this one changed
+                carry_ += changed;
+                ++dropped_;
+                return;
+            case Encoder::COALESCE:
+                queue_.last().image = image;
+                queue_.last().repeat++;
+                queue_.last().changed += changed;
+                ++coalesced_;
+                return;
+            default:
+                while(queue_.count() >= depth_){
+                    not_full_.wait(&mutex_);
+                }
+            }
+        }
+        queue_.enqueue(EncodeItem{image, 1, carry_ + changed});
+        carry_.clear();
+        not_empty_.wakeOne();
+    }
+
+    // for a new output, thread must not be running
+    void reset()
+    {
+        QMutexLocker locker(&mutex_);
+        queue_.clear();
+        carry_.clear();
+        stopping_ = false;
+        dropped_ = 0;
+        coalesced_ = 0;
+    }
+
+    // encodes what is left in queue, then returns
+    void stop()
+    {
+        {
+            QMutexLocker locker(&mutex_);
+            stopping_ = true;
+            not_empty_.wakeOne();
+        }
+        wait();
+    }
+
+    int dropped() const
+    {
+        QMutexLocker locker(&mutex_);
+        return dropped_;
+    }
+
+    int coalesced() const
+    {
+        QMutexLocker locker(&mutex_);
+        return coalesced_;
+    }
+protected:
+    void run()
+    {
+        forever{
+            EncodeItem item;
+            {
+                QMutexLocker locker(&mutex_);
+                while(queue_.isEmpty() && !stopping_){
+                    not_empty_.wait(&mutex_);
+                }
+                if(queue_.isEmpty()){
+                    return;
+                }
+                item = queue_.dequeue();
+                not_full_.wakeOne();
+            }
+            encoder_->encodeImage(item.image, item.repeat, item.changed);
+        }
+    }
+private:
+    Encoder *encoder_;
+    mutable QMutex mutex_;
+    QWaitCondition not_empty_;
+    QWaitCondition not_full_;
+    QQueue<EncodeItem> queue_;
+    QVector<QRect> carry_;
+    int depth_;
+    Encoder::QueuePolicy policy_;
+    bool stopping_;
+    int dropped_;
+    int coalesced_;
+};
+
+Encoder::Encoder() :
+    thread(new EncodeThread(this)),
+    convert_threads(1),
+    skipped_frames(0),
+    finished(true)
+{
+    qCallOnce(register_codecs, register_flag);
+}
+
+Encoder::Encoder(const QSize &s, const QString &n, const QString &config) :
+    Encoder(s, s, n, config)
+{
+}
+
+Encoder::Encoder(const QSize &s,
+                 const QSize &output,
+                 const QString &n,
+                 const QString &config,
+                 ScaleFilter filter) :
+    Encoder()
+{
+    open(s, output, n, config, filter);
+}
+
+Encoder::~Encoder()
+{
+    close();
+    delete thread;
+    qDeleteAll(renditions);
+}
+
+static QSize even_size(const QSize &s)
+{
+    return QSize(qMax(2, s.width() & ~1), qMax(2, s.height() & ~1));
+}
+
+static int filter_flags(Encoder::ScaleFilter filter)
+{
+    switch(filter){
+    case Encoder::FAST_BILINEAR:
+        return SWS_FAST_BILINEAR;
+    case Encoder::BILINEAR:
+        return SWS_BILINEAR;
+    case Encoder::AREA:
+        return SWS_AREA;
+    case Encoder::LANCZOS:
+        return SWS_LANCZOS;
+    default:
+        return SWS_BICUBIC;
+    }
+}
+
+bool Encoder::open(const QSize &s,
+                   const QSize &output,
+                   const QString &n,
+                   const QString &config,
+                   ScaleFilter filter)
+{
+    close();
+    base_size = s;
+    name = n;
+    this->config = config;
+
+    // first rendition keeps its buffers if size fits, others are
+    // added again by caller
+    const QSize size = even_size(output);
+    const int flags = filter_flags(filter);
+    while(renditions.count() > 1){
+        delete renditions.takeLast();
+    }
+    if(!renditions.isEmpty() && (renditions.first()->size != size
+                                 || renditions.first()->scale_flags != flags)){
+        delete renditions.takeFirst();
+    }
+    if(renditions.isEmpty()){
+        renditions.append(new Rendition(size, flags));
+    }
+    if(!renditions.first()->open(n, config)){
+        qWarning()<<"cannot open output"<<n;
+        return false;
+    }
+    updateConverters();
+    thread->reset();
+    skipped_frames = 0;
+    finished = false;
+    return true;
+}
+
+void Encoder::close()
+{
+    finish();
+    for(Rendition *r: renditions){
+        r->close();
+    }
+}
+
+bool Encoder::isOpen() const
+{
+    return !renditions.isEmpty() && renditions.first()->isOpen();
+}
+
+bool Encoder::addRendition(const QSize &output, const QString &n,
+                           ScaleFilter filter)
+{
+    if(thread->isRunning()){
+        qWarning()<<"cannot add rendition while encoding";
+        return false;
+    }
+    if(!isOpen()){
+        qWarning()<<"open encoder before adding renditions";
+        return false;
+    }
+    Rendition *r = new Rendition(even_size(output), filter_flags(filter));
+    if(!r->open(n, config)){
+        qWarning()<<"cannot open rendition"<<n;
+        delete r;
+        return false;
+    }
+    renditions.append(r);
+    updateConverters();
+    return true;
+}
+
+// First rendition converts from canvas. Others are scaled down from its
+// YUV frame, so color is converted only once, unless they are bigger.
+// Converters that still fit are kept.
+void Encoder::updateConverters()
+{
+    if(renditions.isEmpty()){
+        return;
+    }
+    const Rendition *first = renditions.first();
+    for(Rendition *r: renditions){
+        QSize src = base_size;
+        AVPixelFormat format = AV_PIX_FMT_RGB32;
+        int threads = convert_threads;
+        if(r != first && r->size.width() <= first->size.width()
+                && r->size.height() <= first->size.height()){
+            src = first->size;
+            format = AV_PIX_FMT_YUV420P;
+            threads = 1;
+        }
+        if(r->converter && r->converter->matches(src, format, r->size,
+                                                 r->scale_flags, threads)){
+            continue;
+        }
+        delete r->converter;
+        r->converter = new ImageConvert(src, format, r->size,
+                                        r->scale_flags, threads);
+    }
+}
+
+QSize Encoder::outputSize() const
+{
+    if(renditions.isEmpty()){
+        return QSize();
+    }
+    return renditions.first()->size;
+}
+
+int Encoder::renditionCount() const
+{
+    return renditions.count();
+}
+
+void Encoder::setQueue(int depth, Encoder::QueuePolicy policy)
+{
+    thread->setQueue(depth, policy);
+}
+
+void Encoder::setConvertThreads(int count)
+{
+    if(thread->isRunning()){
+        qWarning()<<"cannot change convert threads while encoding";
+        return;
+    }
+    convert_threads = count;
+    updateConverters();
+}
+
+int Encoder::droppedFrames() const
+{
+    return thread->dropped();
+}
+
+int Encoder::coalescedFrames() const
+{
+    return thread->coalesced();
+}
+
+int Encoder::skippedFrames() const
+{
+    return skipped_frames;
+}
+
+bool Encoder::policyFromName(const QString &name, Encoder::QueuePolicy *policy)
+{
+    const QString n = name.toLower();
+    if(n == "block"){
+        *policy = BLOCK;
+    }else if(n == "drop"){
+        *policy = DROP;
+    }else if(n == "coalesce"){
+        *policy = COALESCE;
+    }else{
+        return false;
+    }
+    return true;
+}
+
+bool Encoder::filterFromName(const QString &name, Encoder::ScaleFilter *filter)
+{
+    const QString n = name.toLower();
+    if(n == "fast_bilinear"){
+        *filter = FAST_BILINEAR;
+    }else if(n == "bilinear"){
+        *filter = BILINEAR;
+    }else if(n == "bicubic"){
+        *filter = BICUBIC;
+    }else if(n == "area"){
+        *filter = AREA;
+    }else if(n == "lanczos"){
+        *filter = LANCZOS;
+    }else{
+        return false;
+    }
+    return true;
+}
+
+QSize Encoder::sizeFromString(const QString &size, const QSize &canvas)
+{
+    const QStringList parts = size.toLower().split('x');
+    if(parts.count() != 2){
+        return QSize();
+    }
+    int w = parts[0].toInt();
+    int h = parts[1].toInt();
+    if(w <= 0 && h <= 0){
+        return QSize();
+    }
+    if(w <= 0){
+        w = qRound(qreal(h) * canvas.width() / canvas.height());
+    }else if(h <= 0){
+        h = qRound(qreal(w) * canvas.height() / canvas.width());
+    }
+    return even_size(QSize(w, h));
+}
+
+void Encoder::onImage(const QImage &img)
+{
+    onImage(img, QVector<QRect>() << img.rect());
+}
+
+void Encoder::onImage(const QImage &img, const QVector<QRect> &changed)
+{
+    if(img.isNull()) {
+        qDebug()<<"Error input image";
+        return;
+    }
+    if(!isOpen() || finished){
+        return;
+    }
+    if(!thread->isRunning()){
+        thread->start();
+    }
+    thread->push(img, changed);
+}
+
+// runs in encode thread
+void Encoder::encodeImage(const QImage &img, int repeat,
+                          const QVector<QRect> &changed)
+{
+    Rendition *first = renditions.first();
+    if(changed.isEmpty() && first->primed){
+        for(Rendition *r: renditions){
+            r->skip(repeat);
+        }
+        ++skipped_frames;
+        return;
+    }
+    if(first->primed){
+        first->converter->convert(img, first->frame, changed);
+    }else{
+        first->converter->convert(img, first->frame);
+    }
+    for(Rendition *r: renditions){
+        r->primed = true;
+        if(r == first){
+            continue;
+        }
+        if(r->size.width() > first->size.width()
+                || r->size.height() > first->size.height()){
+            r->converter->convert(img, r->frame);
+        }else{
+            r->converter->convert(first->frame, r->frame);
+        }
+    }
+    for(Rendition *r: renditions){
+        r->encode(repeat);
+    }
+}
+
+void Encoder::finish()
+{
+    if(finished){
+        return;
+    }
+    finished = true;
+    thread->stop();
+    if(droppedFrames() || coalescedFrames()){
+        qDebug()<<"encoder queue dropped"<<droppedFrames()
+               <<"coalesced"<<coalescedFrames()<<"images";
+    }
+    if(skipped_frames){
+        qDebug()<<"encoder skipped"<<skipped_frames<<"unchanged images";
+    }
+    for(Rendition *r: renditions){
+        if(r->isOpen()){
+            r->flush();
+        }
+    }
+}
@@ -3,37 +3,105 @@
 
 #include <QSize>
 #include <QString>
+#include <QList>
+#include <QVector>
+#include <QRect>
 
-class AVCodec;
-class AVCodecContext;
-class AVFrame;
-class AVDictionary;
-class AVStream;
-class AVFormatContext;
-class ImageConvert;
+class EncodeThread;
+class Rendition;
 class QImage;
 
+/*
+ * Images passed to onImage() are queued and encoded on a thread of the
+ * Encoder's own, so painting goes on while frames are being encoded.
+ * What happens when the queue is full depends on QueuePolicy.
+ *
+ * Video size may differ from canvas size, scaling is done by the same
+ * sws_scale() call converting color. More renditions of other sizes
+ * can be written from the same images, see addRendition().
+ *
+ * After finish() an Encoder can be open()ed again for another file,
+ * frame buffers and converters are reused if sizes did not change.
+ */
 class Encoder
 {
 public:
+    enum QueuePolicy {
+        BLOCK = 0,  // wait for a free slot, nothing is lost
+        DROP,       // throw the new image away
+        COALESCE    // new image replaces the newest queued one,
+                    // which then lasts for both
+    };
+
+    enum ScaleFilter {
+        FAST_BILINEAR = 0,
+        BILINEAR,
+        BICUBIC,
+        AREA,
+        LANCZOS
+    };
+
+    Encoder();
     explicit Encoder(const QSize &s,
                      const QString &n,
                      const QString &config);
+    Encoder(const QSize &s,
+            const QSize &output,
+            const QString &n,
+            const QString &config,
+            ScaleFilter filter = BICUBIC);
     ~Encoder();
 
+    // finishes current output first
+    bool open(const QSize &s,
+              const QSize &output,
+              const QString &n,
+              const QString &config,
+              ScaleFilter filter = BICUBIC);
+    bool isOpen() const;
+    // finish() and release the output files
+    void close();
+
+    // another video file from same images, must be called after open()
+    // and before first onImage(); odd sizes are rounded down to even ones
+    bool addRendition(const QSize &output, const QString &n,
+                      ScaleFilter filter = BICUBIC);
+    QSize outputSize() const;
+    int renditionCount() const;
+
+    // must be called before first onImage()
+    void setQueue(int depth, QueuePolicy policy);
+    // color conversion is split into horizontal bands, one per thread;
+    // only used while video is not scaled
+    void setConvertThreads(int count);
+    int droppedFrames() const;
+    int coalescedFrames() const;
+    // images that changed nothing, and were not encoded
+    int skippedFrames() const;
+    static bool policyFromName(const QString &name, QueuePolicy *policy);
+    static bool filterFromName(const QString &name, ScaleFilter *filter);
+    // "WxH", a 0 side follows canvas aspect ratio, e.g. "0x720"
+    static QSize sizeFromString(const QString &size, const QSize &canvas);
+
     void onImage(const QImage &img);
+    // only changed parts of img are converted again,
+    // img is not encoded at all if changed is empty
+    void onImage(const QImage &img, const QVector<QRect> &changed);
     void finish();
 protected:
+    friend class EncodeThread;
+    void encodeImage(const QImage &img, int repeat,
+                     const QVector<QRect> &changed);
+    void updateConverters();
+
+    EncodeThread* thread;
     QSize base_size;
     QString name;
-    ImageConvert* converter;
-    AVCodec* codec;
-    AVCodecContext* context;
-    AVFrame* frame;
-    AVFormatContext* format;
-    AVDictionary *d;
-    AVStream *stream;
-    int frame_count;
+    QString config;
+    int convert_threads;
+    int skipped_frames;
+    bool finished;
+    QList<Rendition*> renditions;
 };
 
 #endif // ENCODER_H
@@ -0,0 +1,401 @@
+#include "yuvconvert.h"
+
+#include <QThreadPool>
+#include <QRunnable>
+#include <QSemaphore>
+#include <string.h>
+
+#include "../misc/cpufeatures.h"
+
+#if defined(Q_PROCESSOR_X86)
+#include <emmintrin.h>
+#include <immintrin.h>
+#endif
+
+#if defined(Q_PROCESSOR_X86) && defined(Q_CC_GNU)
+#define YUV_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define YUV_TARGET_AVX2
+#endif
+
+// converts rows r0 and r1, chroma of their 2x2 blocks goes to u and v;
+// y1 is null for the last row of odd heights
+typedef void (*RowFunc)(const uchar *r0, const uchar *r1, int width,
+                        uchar *y0, uchar *y1, uchar *u, uchar *v);
+
+// BT.601 limited range, 8 bit fixed point
+static inline uchar luma(int r, int g, int b)
+{
+    return uchar(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+}
+
+// 32768 keeps the sum positive, so shifts round the same way in simd
+static inline uchar chroma_u(int r, int g, int b)
+{
+    return uchar((-38 * r - 74 * g + 112 * b + 128 + 32768) >> 8);
+}
+
+static inline uchar chroma_v(int r, int g, int b)
+{
+    return uchar((112 * r - 94 * g - 18 * b + 128 + 32768) >> 8);
+}
+
+// from pixel x on, pixels up to width
+static void row_scalar_from(int x, const uchar *r0, const uchar *r1, int width,
+                            uchar *y0, uchar *y1, uchar *u, uchar *v)
+{
+    for(;x<width;x+=2){
+        const int x1 = (x + 1 < width) ? x + 1 : x;
+        const uchar *a = r0 + x * 4;
+        const uchar *b = r0 + x1 * 4;
+        const uchar *c = r1 + x * 4;
+        const uchar *d = r1 + x1 * 4;
+        y0[x] = luma(a[2], a[1], a[0]);
+        if(x1 != x){
+            y0[x1] = luma(b[2], b[1], b[0]);
+        }
+        if(y1){
+            y1[x] = luma(c[2], c[1], c[0]);
+            if(x1 != x){
+                y1[x1] = luma(d[2], d[1], d[0]);
+            }
+        }
+        const int bb = (a[0] + b[0] + c[0] + d[0] + 2) >> 2;
+        const int gg = (a[1] + b[1] + c[1] + d[1] + 2) >> 2;
+        const int rr = (a[2] + b[2] + c[2] + d[2] + 2) >> 2;
+        u[x >> 1] = chroma_u(rr, gg, bb);
+        v[x >> 1] = chroma_v(rr, gg, bb);
+    }
+}
+
+static void row_scalar(const uchar *r0, const uchar *r1, int width,
+                       uchar *y0, uchar *y1, uchar *u, uchar *v)
+{
+    row_scalar_from(0, r0, r1, width, y0, y1, u, v);
+}
+
+#if defined(Q_PROCESSOR_X86)
+
+// [a0+a1, a2+a3, b0+b1, b2+b3] of two madd results
+static inline __m128i pair_sum_sse2(__m128i a, __m128i b)
+{
+    const __m128 fa = _mm_castsi128_ps(a);
+    const __m128 fb = _mm_castsi128_ps(b);
+    const __m128i even = _mm_castps_si128(_mm_shuffle_ps(fa, fb, _MM_SHUFFLE(2, 0, 2, 0)));
+    const __m128i odd = _mm_castps_si128(_mm_shuffle_ps(fa, fb, _MM_SHUFFLE(3, 1, 3, 1)));
+    return _mm_add_epi32(even, odd);
+}
+
+// luma of 4 pixels as 32 bit lanes
+static inline __m128i luma4_sse2(__m128i p, __m128i coef, __m128i zero)
+{
+    const __m128i lo = _mm_madd_epi16(_mm_unpacklo_epi8(p, zero), coef);
+    const __m128i hi = _mm_madd_epi16(_mm_unpackhi_epi8(p, zero), coef);
+    __m128i y = pair_sum_sse2(lo, hi);
+    y = _mm_srai_epi32(_mm_add_epi32(y, _mm_set1_epi32(128)), 8);
+    return _mm_add_epi32(y, _mm_set1_epi32(16));
+}
+
+// rounded average of each 2x2 block of 4 pixels wide rows, as
+// 16 bit b, g, r, a of block 0 then block 1
+static inline __m128i block_avg_sse2(__m128i p0, __m128i p1, __m128i zero)
+{
+    const __m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(p0, zero),
+                                     _mm_unpacklo_epi8(p1, zero));
+    const __m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(p0, zero),
+                                     _mm_unpackhi_epi8(p1, zero));
+    const __m128i s0 = _mm_add_epi16(lo, _mm_srli_si128(lo, 8));
+    const __m128i s1 = _mm_add_epi16(hi, _mm_srli_si128(hi, 8));
+    const __m128i s = _mm_unpacklo_epi64(s0, s1);
+    return _mm_srli_epi16(_mm_add_epi16(s, _mm_set1_epi16(2)), 2);
+}
+
+static inline __m128i chroma4_sse2(__m128i avg_a, __m128i avg_b, __m128i coef)
+{
+    __m128i c = pair_sum_sse2(_mm_madd_epi16(avg_a, coef),
+                              _mm_madd_epi16(avg_b, coef));
+    return _mm_srai_epi32(_mm_add_epi32(c, _mm_set1_epi32(128 + 32768)), 8);
+}
+
+static inline void store4(uchar *dst, __m128i x)
+{
+    const int bytes = _mm_cvtsi128_si32(x);
+    memcpy(dst, &bytes, 4);
+}
+
+static void row_sse2(const uchar *r0, const uchar *r1, int width,
+                     uchar *y0, uchar *y1, uchar *u, uchar *v)
+{
+    const __m128i zero = _mm_setzero_si128();
+    // memory order of a pixel is b, g, r, a
+    const __m128i cy = _mm_set_epi16(0, 66, 129, 25, 0, 66, 129, 25);
+    const __m128i cu = _mm_set_epi16(0, -38, -74, 112, 0, -38, -74, 112);
+    const __m128i cv = _mm_set_epi16(0, 112, -94, -18, 0, 112, -94, -18);
+    int x = 0;
+    for(;x+8<=width;x+=8){
+        const __m128i a0 = _mm_loadu_si128((const __m128i*)(r0 + x * 4));
+        const __m128i b0 = _mm_loadu_si128((const __m128i*)(r0 + x * 4 + 16));
+        const __m128i a1 = _mm_loadu_si128((const __m128i*)(r1 + x * 4));
+        const __m128i b1 = _mm_loadu_si128((const __m128i*)(r1 + x * 4 + 16));
+
+        __m128i y = _mm_packs_epi32(luma4_sse2(a0, cy, zero),
+                                    luma4_sse2(b0, cy, zero));
+        _mm_storel_epi64((__m128i*)(y0 + x), _mm_packus_epi16(y, y));
+        if(y1){
+            y = _mm_packs_epi32(luma4_sse2(a1, cy, zero),
+                                luma4_sse2(b1, cy, zero));
+            _mm_storel_epi64((__m128i*)(y1 + x), _mm_packus_epi16(y, y));
+        }
+
+        const __m128i avg_a = block_avg_sse2(a0, a1, zero);
+        const __m128i avg_b = block_avg_sse2(b0, b1, zero);
+        __m128i c = chroma4_sse2(avg_a, avg_b, cu);
+        c = _mm_packs_epi32(c, c);
+        store4(u + (x >> 1), _mm_packus_epi16(c, c));
+        c = chroma4_sse2(avg_a, avg_b, cv);
+        c = _mm_packs_epi32(c, c);
+        store4(v + (x >> 1), _mm_packus_epi16(c, c));
+    }
+    row_scalar_from(x, r0, r1, width, y0, y1, u, v);
+}
+
+YUV_TARGET_AVX2
+static inline __m256i pair_sum_avx2(__m256i a, __m256i b)
+{
+    const __m256 fa = _mm256_castsi256_ps(a);
+    const __m256 fb = _mm256_castsi256_ps(b);
+    const __m256i even = _mm256_castps_si256(_mm256_shuffle_ps(fa, fb, _MM_SHUFFLE(2, 0, 2, 0)));
+    const __m256i odd = _mm256_castps_si256(_mm256_shuffle_ps(fa, fb, _MM_SHUFFLE(3, 1, 3, 1)));
+    return _mm256_add_epi32(even, odd);
+}
+
+// luma of 8 pixels, in pixel order
+YUV_TARGET_AVX2
+static inline __m256i luma8_avx2(__m256i p, __m256i coef, __m256i zero)
+{
+    const __m256i lo = _mm256_madd_epi16(_mm256_unpacklo_epi8(p, zero), coef);
+    const __m256i hi = _mm256_madd_epi16(_mm256_unpackhi_epi8(p, zero), coef);
+    __m256i y = pair_sum_avx2(lo, hi);
+    y = _mm256_srai_epi32(_mm256_add_epi32(y, _mm256_set1_epi32(128)), 8);
+    return _mm256_add_epi32(y, _mm256_set1_epi32(16));
+}
+
+// 8 x 32 bit to 8 x 16 bit, saturated
+YUV_TARGET_AVX2
+static inline __m128i narrow_avx2(__m256i x)
+{
+    return _mm_packs_epi32(_mm256_castsi256_si128(x),
+                           _mm256_extracti128_si256(x, 1));
+}
+
+// blocks 0 and 1 in low lane, 2 and 3 in high lane
+YUV_TARGET_AVX2
+static inline __m256i block_avg_avx2(__m256i p0, __m256i p1, __m256i zero)
+{
+    const __m256i lo = _mm256_add_epi16(_mm256_unpacklo_epi8(p0, zero),
+                                        _mm256_unpacklo_epi8(p1, zero));
+    const __m256i hi = _mm256_add_epi16(_mm256_unpackhi_epi8(p0, zero),
+                                        _mm256_unpackhi_epi8(p1, zero));
+    const __m256i s0 = _mm256_add_epi16(lo, _mm256_srli_si256(lo, 8));
+    const __m256i s1 = _mm256_add_epi16(hi, _mm256_srli_si256(hi, 8));
+    const __m256i s = _mm256_unpacklo_epi64(s0, s1);
+    return _mm256_srli_epi16(_mm256_add_epi16(s, _mm256_set1_epi16(2)), 2);
+}
+
+// chroma of 8 blocks, in block order
+YUV_TARGET_AVX2
+static inline __m256i chroma8_avx2(__m256i avg_a, __m256i avg_b, __m256i coef)
+{
+    __m256i c = pair_sum_avx2(_mm256_madd_epi16(avg_a, coef),
+                              _mm256_madd_epi16(avg_b, coef));
+    c = _mm256_srai_epi32(_mm256_add_epi32(c, _mm256_set1_epi32(128 + 32768)), 8);
+    // lanes hold blocks 0 1 4 5 | 2 3 6 7
+    return _mm256_permutevar8x32_epi32(c, _mm256_setr_epi32(0, 1, 4, 5, 2, 3, 6, 7));
+}
+
+YUV_TARGET_AVX2
+static void row_avx2(const uchar *r0, const uchar *r1, int width,
+                     uchar *y0, uchar *y1, uchar *u, uchar *v)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i cy = _mm256_set_epi16(0, 66, 129, 25, 0, 66, 129, 25,
+                                        0, 66, 129, 25, 0, 66, 129, 25);
+    const __m256i cu = _mm256_set_epi16(0, -38, -74, 112, 0, -38, -74, 112,
+                                        0, -38, -74, 112, 0, -38, -74, 112);
+    const __m256i cv = _mm256_set_epi16(0, 112, -94, -18, 0, 112, -94, -18,
+                                        0, 112, -94, -18, 0, 112, -94, -18);
+    int x = 0;
+    for(;x+16<=width;x+=16){
+        const __m256i a0 = _mm256_loadu_si256((const __m256i*)(r0 + x * 4));
+        const __m256i b0 = _mm256_loadu_si256((const __m256i*)(r0 + x * 4 + 32));
+        const __m256i a1 = _mm256_loadu_si256((const __m256i*)(r1 + x * 4));
+        const __m256i b1 = _mm256_loadu_si256((const __m256i*)(r1 + x * 4 + 32));
+
+        __m128i y = _mm_packus_epi16(narrow_avx2(luma8_avx2(a0, cy, zero)),
+                                     narrow_avx2(luma8_avx2(b0, cy, zero)));
+        _mm_storeu_si128((__m128i*)(y0 + x), y);
+        if(y1){
+            y = _mm_packus_epi16(narrow_avx2(luma8_avx2(a1, cy, zero)),
+                                 narrow_avx2(luma8_avx2(b1, cy, zero)));
+            _mm_storeu_si128((__m128i*)(y1 + x), y);
+        }
+
+        const __m256i avg_a = block_avg_avx2(a0, a1, zero);
+        const __m256i avg_b = block_avg_avx2(b0, b1, zero);
+        __m128i c = narrow_avx2(chroma8_avx2(avg_a, avg_b, cu));
+        _mm_storel_epi64((__m128i*)(u + (x >> 1)), _mm_packus_epi16(c, c));
+        c = narrow_avx2(chroma8_avx2(avg_a, avg_b, cv));
+        _mm_storel_epi64((__m128i*)(v + (x >> 1)), _mm_packus_epi16(c, c));
+    }
+    row_sse2(r0 + x * 4, r1 + x * 4, width - x,
+             y0 + x, y1 ? y1 + x : nullptr, u + (x >> 1), v + (x >> 1));
+}
+
+#endif // Q_PROCESSOR_X86
+
+static bool cpu_supports(YuvConvert::Kernel k)
+{
+    switch(k){
+    case YuvConvert::SCALAR:
+        return true;
+#if defined(Q_PROCESSOR_X86)
+    case YuvConvert::SSE2:
+        return CpuFeatures::hasSse2();
+    case YuvConvert::AVX2:
+        return CpuFeatures::hasAvx2();
+#endif
+    default:
+        return false;
+    }
+}
+
+static RowFunc row_func(YuvConvert::Kernel k)
+{
+    switch(k){
+#if defined(Q_PROCESSOR_X86)
+    case YuvConvert::SSE2:
+        return row_sse2;
+    case YuvConvert::AVX2:
+        return row_avx2;
+#endif
+    default:
+        return row_scalar;
+    }
+}
+
+static YuvConvert::Kernel best_kernel()
+{
+    if(cpu_supports(YuvConvert::AVX2)){
+        return YuvConvert::AVX2;
+    }
+    if(cpu_supports(YuvConvert::SSE2)){
+        return YuvConvert::SSE2;
+    }
+    return YuvConvert::SCALAR;
+}
+
+static YuvConvert::Kernel current_kernel = best_kernel();
+static RowFunc current_func = row_func(current_kernel);
+
+YuvConvert::Kernel YuvConvert::kernel()
+{
+    return current_kernel;
+}
+
+bool YuvConvert::setKernel(YuvConvert::Kernel k)
+{
+    if(!cpu_supports(k)){
+        return false;
+    }
+    current_kernel = k;
+    current_func = row_func(k);
+    return true;
+}
+
+bool YuvConvert::supports(YuvConvert::Kernel k)
+{
+    return cpu_supports(k);
+}
+
+const char* YuvConvert::kernelName(YuvConvert::Kernel k)
+{
+    switch(k){
+    case SSE2:
+        return "sse2";
+    case AVX2:
+        return "avx2";
+    default:
+        return "scalar";
+    }
+}
+
+struct ConvertJob
+{
+    const uchar *bgra;
+    int stride;
+    int width;
+    int height;
+    uchar *const *planes;
+    const int *linesize;
+    RowFunc func;
+};
+
+// rows [top, bottom), top is even
+static void convert_rows(const ConvertJob &job, int top, int bottom)
+{
+    for(int y=top;y<bottom;y+=2){
+        const bool pair = y + 1 < job.height;
+        const uchar *r0 = job.bgra + qptrdiff(y) * job.stride;
+        const uchar *r1 = pair ? r0 + job.stride : r0;
+        uchar *y0 = job.planes[0] + qptrdiff(y) * job.linesize[0];
+        uchar *y1 = pair ? y0 + job.linesize[0] : nullptr;
+        uchar *u = job.planes[1] + qptrdiff(y >> 1) * job.linesize[1];
+        uchar *v = job.planes[2] + qptrdiff(y >> 1) * job.linesize[2];
+        job.func(r0, r1, job.width, y0, y1, u, v);
+    }
+}
+
+class BandTask : public QRunnable
+{
+public:
+    BandTask(const ConvertJob &job, int top, int bottom, QSemaphore *done)
+        :job_(job), top_(top), bottom_(bottom), done_(done)
+    {
+    }
+    void run()
+    {
+        convert_rows(job_, top_, bottom_);
+        done_->release();
+    }
+private:
+    const ConvertJob &job_;
+    int top_;
+    int bottom_;
+    QSemaphore *done_;
+};
+
+void YuvConvert::convert(const uchar *bgra, int stride,
+                         int width, int height,
+                         uchar *const planes[3], const int linesize[3],
+                         int threads)
+{
+    const ConvertJob job = {bgra, stride, width, height,
+                            planes, linesize, current_func};
+    const int pairs = (height + 1) / 2;
+    const int bands = qBound(1, threads, qMax(1, pairs));
+    if(bands == 1){
+        convert_rows(job, 0, height);
+        return;
+    }
+    // band i is rows [band_top(i), band_top(i+1))
+    auto band_top = [pairs, bands, height](int i) {
+        return qMin(height, (pairs * i / bands) * 2);
+    };
+    QSemaphore done;
+    for(int i=1;i<bands;++i){
+        QThreadPool::globalInstance()->start(
+                    new BandTask(job, band_top(i), band_top(i + 1), &done));
+    }
+    convert_rows(job, 0, band_top(1));
+    done.acquire(bands - 1);
+}
@@ -0,0 +1,37 @@
+#ifndef YUVCONVERT_H
+#define YUVCONVERT_H
+
+#include <QtGlobal>
+
+/*
+ * YuvConvert turns opaque 32 bit BGRA (QImage::Format_RGB32 and opaque
+ * Format_ARGB32_Premultiplied on little endian) into planar I420 with
+ * BT.601 limited range coefficients, as swscale does by default.
+ * Chroma is the average of each 2x2 block. Alpha is ignored.
+ *
+ * Every kernel gives the same result. It matches swscale with SWS_AREA
+ * up to rounding, bench/yuvconvert checks by how much.
+ */
+class YuvConvert
+{
+public:
+    enum Kernel {
+        SCALAR = 0,
+        SSE2,
+        AVX2
+    };
+
+    static Kernel kernel();
+    // for benchmarks, returns false if cpu cannot run k
+    static bool setKernel(Kernel k);
+    static bool supports(Kernel k);
+    static const char* kernelName(Kernel k);
+
+    // rows are split into bands converted by threads of the global pool
+    static void convert(const uchar *bgra, int stride,
+                        int width, int height,
+                        uchar *const planes[3], const int linesize[3],
+                        int threads = 1);
+};
+
+#endif // YUVCONVERT_H
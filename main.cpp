@@ -3,7 +3,11 @@
 #include <QFile>
 #include <QDebug>
 #include "canvasengine.h"
+#include "batchrunner.h"
 #include "encoder/encoder.h"
+#include "misc/strokecodec.h"
+#include "misc/layer.h"
+#include "misc/archiveindex.h"
 
 int main(int argc, char *argv[])
 {
@@ -26,9 +30,135 @@ int main(int argc, char *argv[])
     QCommandLineOption fullSpeedOption(QStringList() << "f"
                                        << "fullspeed", "Full speed painting.");
     parser.addOption(fullSpeedOption);
+    QCommandLineOption offlineOption(QStringList() << "o"
+                                     << "offline", "Replay in a tight loop, without event loop pacing.");
+    parser.addOption(offlineOption);
+    QCommandLineOption batchOption(QStringList() << "b"
+                                   << "batch", "Replay every job in manifest file.",
+                                   "manifest");
+    parser.addOption(batchOption);
+    QCommandLineOption jobsOption(QStringList() << "j"
+                                  << "jobs", "Number of archives replayed at the same time in batch mode.",
+                                  "count");
+    parser.addOption(jobsOption);
+    QCommandLineOption convertOption(QStringList() << "c"
+                                     << "convert", "Convert archive given as the only argument to binary stroke records.",
+                                     "output");
+    parser.addOption(convertOption);
+    QCommandLineOption queueOption(QStringList() << "queue",
+                                   "Number of images waiting for video encoder, 4 by default.",
+                                   "depth", "4");
+    parser.addOption(queueOption);
+    QCommandLineOption backpressureOption(QStringList() << "backpressure",
+                                          "What to do when encoder queue is full: block, drop or coalesce.",
+                                          "policy", "block");
+    parser.addOption(backpressureOption);
+    QCommandLineOption convertThreadsOption(QStringList() << "convert-threads",
+                                            "Threads used for video color conversion.",
+                                            "count", "1");
+    parser.addOption(convertThreadsOption);
+    QCommandLineOption snapshotOption(QStringList() << "snapshot",
+                                      "When to send canvas to video: every N blocks, dabs or ms, or N frames in total.",
+                                      "blocks|dabs|ms|frames", "blocks");
+    parser.addOption(snapshotOption);
+    QCommandLineOption snapshotValueOption(QStringList() << "snapshot-value",
+                                           "The N of --snapshot, 20 by default.",
+                                           "N", "20");
+    parser.addOption(snapshotValueOption);
+    QCommandLineOption videoSizeOption(QStringList() << "video-size",
+                                       "Size of video, canvas size by default. A 0 side keeps aspect ratio.",
+                                       "WxH");
+    parser.addOption(videoSizeOption);
+    QCommandLineOption scaleFilterOption(QStringList() << "scale-filter",
+                                         "Filter used to scale video: fast_bilinear, bilinear, bicubic, area or lanczos.",
+                                         "filter", "bicubic");
+    parser.addOption(scaleFilterOption);
+    QCommandLineOption renditionOption(QStringList() << "rendition",
+                                       "Also write a video of another size, can be repeated.",
+                                       "WxH:file");
+    parser.addOption(renditionOption);
+    QCommandLineOption paintThreadsOption(QStringList() << "paint-threads",
+                                          "Threads painting strokes, each owns some of the layers.",
+                                          "count", "1");
+    parser.addOption(paintThreadsOption);
+    QCommandLineOption bandThreadsOption(QStringList() << "band-threads",
+                                         "Threads blending dabs of one stroke, each owns a band of tile rows.",
+                                         "count", "1");
+    parser.addOption(bandThreadsOption);
+    QCommandLineOption decodeThreadsOption(QStringList() << "decode-threads",
+                                           "Threads inflating and decoding packs in offline replay.",
+                                           "count", "1");
+    parser.addOption(decodeThreadsOption);
+    QCommandLineOption indexOption(QStringList() << "index",
+                                   "Write index sidecar of archive given as the only argument.");
+    parser.addOption(indexOption);
+    QCommandLineOption untilOption(QStringList() << "until",
+                                   "Stop replay before pack N, or once P% of points are painted. Implies --offline.",
+                                   "N|P%");
+    parser.addOption(untilOption);
+    QCommandLineOption checkpointOption(QStringList() << "checkpoint-every",
+                                        "Save a checkpoint every N blocks next to archive, in offline replay.",
+                                        "N");
+    parser.addOption(checkpointOption);
+    QCommandLineOption resumeOption(QStringList() << "resume",
+                                    "Go on from the latest checkpoint of archive. Implies --offline.");
+    parser.addOption(resumeOption);
 
     parser.process(app);
 
+    Layer::setBandThreads(parser.value(bandThreadsOption).toInt());
+
+    if(parser.isSet(convertOption)) {
+        const QStringList args = parser.positionalArguments();
+        if(args.isEmpty()) {
+            parser.showHelp(0);
+            return 0;
+        }
+        QFile input(args.at(0));
+        if (!input.open(QIODevice::ReadOnly)) {
+            qDebug()<<"Lack of input file";
+            return -1;
+        }
+        QFile output(parser.value(convertOption));
+        if (!output.open(QIODevice::WriteOnly)) {
+            qDebug()<<"Output file unknown";
+            return -1;
+        }
+        return StrokeCodec::convertArchive(input, output) ? 0 : -1;
+    }
+
+    if(parser.isSet(indexOption)) {
+        const QStringList args = parser.positionalArguments();
+        if(args.isEmpty()) {
+            parser.showHelp(0);
+            return 0;
+        }
+        QFile input(args.at(0));
+        if (!input.open(QIODevice::ReadOnly)) {
+            qDebug()<<"Lack of input file";
+            return -1;
+        }
+        ArchiveIndex index;
+        QFile output(ArchiveIndex::sidecarName(args.at(0)));
+        if (!index.build(input) || !output.open(QIODevice::WriteOnly)
+                || !index.save(output)) {
+            qDebug()<<"Cannot write index";
+            return -1;
+        }
+        qDebug()<<index.count()<<"packs"<<index.totalPoints()<<"points";
+        return 0;
+    }
+
+    if(parser.isSet(batchOption)) {
+        BatchRunner runner(parser.value(jobsOption).toInt());
+        if(!runner.loadManifest(parser.value(batchOption))) {
+            return -1;
+        }
+        runner.run();
+        runner.printSummary();
+        return runner.failedCount() ? 1 : 0;
+    }
+
     const QStringList args = parser.positionalArguments();
 
     if(args.length() < 4) {
@@ -37,6 +167,8 @@ int main(int argc, char *argv[])
     }
 
     bool fullspeed = parser.isSet(fullSpeedOption);
+    const bool seek = parser.isSet(untilOption) || parser.isSet(resumeOption);
+    bool offline = parser.isSet(offlineOption) || seek;
 
     QSize canvasSize(args.at(0).toInt(),
                      args.at(1).toInt());
@@ -46,6 +178,20 @@ int main(int argc, char *argv[])
         return -1;
     }
 
+    ArchiveIndex index;
+    int untilPack = -1;
+    if(seek) {
+        if(!index.open(args.at(2))) {
+            return -1;
+        }
+        untilPack = parser.isSet(untilOption) ? index.position(parser.value(untilOption))
+                                              : index.count();
+        if(untilPack < 0) {
+            qDebug()<<"Bad replay position";
+            return -1;
+        }
+    }
+
     QFile output(args.at(3));
     if (!output.open(QIODevice::WriteOnly)) {
         qDebug()<<"Output file unknown";
@@ -60,22 +206,71 @@ int main(int argc, char *argv[])
     QString config = QString::fromUtf8(configFile.readAll());
     configFile.close();
 
-    Encoder *encoder = new Encoder(canvasSize, "output.mkv", config);
+    SnapshotScheduler::Policy snapshotPolicy;
+    if(!SnapshotScheduler::policyFromName(parser.value(snapshotOption), &snapshotPolicy)) {
+        qDebug()<<"Unknown snapshot policy";
+        return -1;
+    }
+
+    Encoder::QueuePolicy policy;
+    if(!Encoder::policyFromName(parser.value(backpressureOption), &policy)) {
+        qDebug()<<"Unknown backpressure policy";
+        return -1;
+    }
+
+    Encoder::ScaleFilter filter;
+    if(!Encoder::filterFromName(parser.value(scaleFilterOption), &filter)) {
+        qDebug()<<"Unknown scale filter";
+        return -1;
+    }
+    QSize videoSize = canvasSize;
+    if(parser.isSet(videoSizeOption)) {
+        videoSize = Encoder::sizeFromString(parser.value(videoSizeOption), canvasSize);
+        if(videoSize.isEmpty()) {
+            qDebug()<<"Bad video size";
+            return -1;
+        }
+    }
+
+    Encoder *encoder = new Encoder(canvasSize, videoSize, "output.mkv", config, filter);
+    for(const QString &rendition: parser.values(renditionOption)) {
+        const int sep = rendition.indexOf(':');
+        const QSize size = Encoder::sizeFromString(rendition.left(sep), canvasSize);
+        if(sep < 0 || size.isEmpty()) {
+            qDebug()<<"Bad rendition"<<rendition;
+            return -1;
+        }
+        encoder->addRendition(size, rendition.mid(sep + 1), filter);
+    }
+    encoder->setQueue(parser.value(queueOption).toInt(), policy);
+    encoder->setConvertThreads(parser.value(convertThreadsOption).toInt());
 
     CanvasEngine *engine = new CanvasEngine(canvasSize);
     engine->setFullspeed(fullspeed);
+    engine->setOffline(offline);
+    engine->setPaintThreads(parser.value(paintThreadsOption).toInt());
+    engine->setDecodeThreads(parser.value(decodeThreadsOption).toInt());
+    if(seek && !engine->replayUntil(index, untilPack)) {
+        qDebug()<<"Cannot load checkpoint";
+        return -1;
+    }
+    if(parser.isSet(checkpointOption)) {
+        engine->setCheckpointing(parser.value(checkpointOption).toInt(),
+                                 ArchiveIndex::checkpointDir(args.at(2)));
+    }
+    engine->setSnapshotPolicy(snapshotPolicy,
+                              parser.value(snapshotValueOption).toLongLong());
     engine->setOutput(output);
     engine->setInput(input);
-    CanvasEngine::connect(engine, &CanvasEngine::canvasUpdated,
+    CanvasEngine::connect(engine, &CanvasEngine::snapshotDue,
                           [engine, encoder]() {
-        static quint64 times = 0;
-        if(times % 20 == 0) {
-            encoder->onImage(engine->allCanvas());
-        }
-        times++;
+        QVector<QRect> changed;
+        const QImage canvas = engine->allCanvas(&changed);
+        encoder->onImage(canvas, changed);
     });
     CanvasEngine::connect(engine, &CanvasEngine::parseEnded,
                           [encoder, engine](){
+        qDebug()<<"stroke queue high watermark:"<<engine->strokeQueueHighWatermark();
         encoder->finish();
         delete encoder;
         engine->deleteLater();
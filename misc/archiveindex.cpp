@@ -0,0 +1,251 @@
+#include "archiveindex.h"
+
+#include <QIODevice>
+#include <QFile>
+#include <QDir>
+#include <QFileInfo>
+#include <QDataStream>
+#include <QDebug>
+#include <QtCore/qmath.h>
+#include <algorithm>
+
+#include "strokecodec.h"
+
+static const quint32 magic = 0x50494458; // "PIDX"
+static const quint8 version = 1;
+
+ArchiveIndex::ArchiveIndex()
+    :archive_size_(0)
+{
+}
+
+bool ArchiveIndex::build(QIODevice &archive)
+{
+    entries_.clear();
+    checkpoints_.clear();
+    if(!archive.seek(0)){
+        return false;
+    }
+    archive_size_ = archive.size();
+
+    PackParser::ParserResult result;
+    StrokeBatch stroke;
+    QByteArray rawpack;
+    quint64 points = 0;
+    qint64 offset = 0;
+    while(PackParser::readRawPack(archive, rawpack)){
+        const qint64 next = archive.pos();
+        if(!rawpack.isEmpty()){
+            // only strokes need decoding, to count their points
+            const PackParser::PACK_TYPE type =
+                    PackParser::PACK_TYPE((rawpack[0] & binL<110>::value) >> 0x1);
+            if(type == PackParser::DATA
+                    && PackParser::unpack(rawpack, result)
+                    && StrokeCodec::fromData(result.pack_data, stroke)){
+                points += stroke.points.count();
+            }
+            entries_.append(Entry{offset, quint32(rawpack.size()), type, points});
+        }
+        offset = next;
+    }
+    return true;
+}
+
+bool ArchiveIndex::save(QIODevice &device) const
+{
+    QDataStream out(&device);
+    out<<magic<<version<<archive_size_<<qint32(entries_.count());
+    for(const Entry &e: entries_){
+        out<<e.offset<<e.size<<quint8(e.type)<<e.points;
+    }
+    out<<qint32(checkpoints_.count());
+    for(const Checkpoint &c: checkpoints_){
+        out<<qint32(c.pack)<<c.file;
+    }
+    return out.status() == QDataStream::Ok;
+}
+
+bool ArchiveIndex::load(QIODevice &device)
+{
+    QDataStream in(&device);
+    quint32 m;
+    quint8 v;
+    qint32 count;
+    in>>m>>v;
+    if(m != magic || v != version){
+        return false;
+    }
+    in>>archive_size_>>count;
+    // counts come from a file that may be truncated or garbage, a pack
+    // takes at least 5 bytes of archive
+    if(in.status() != QDataStream::Ok || archive_size_ < 0
+            || count < 0 || count > archive_size_ / 5){
+        return false;
+    }
+    entries_.resize(count);
+    for(Entry &e: entries_){
+        quint8 type;
+        in>>e.offset>>e.size>>type>>e.points;
+        e.type = PackParser::PACK_TYPE(type);
+    }
+    in>>count;
+    // a checkpoint is taken before a pack, or at the end
+    if(in.status() != QDataStream::Ok
+            || count < 0 || count > entries_.count() + 1){
+        return false;
+    }
+    checkpoints_.resize(count);
+    for(Checkpoint &c: checkpoints_){
+        qint32 pack;
+        in>>pack>>c.file;
+        c.pack = pack;
+    }
+    return in.status() == QDataStream::Ok;
+}
+
+bool ArchiveIndex::open(const QString &archiveName)
+{
+    QFile archive(archiveName);
+    if(!archive.open(QIODevice::ReadOnly)){
+        qWarning()<<"cannot open archive"<<archiveName;
+        return false;
+    }
+    QFile sidecar(sidecarName(archiveName));
+    if(sidecar.open(QIODevice::ReadOnly)
+            && load(sidecar) && archive_size_ == archive.size()){
+        scanCheckpoints(checkpointDir(archiveName));
+        return true;
+    }
+    sidecar.close();
+    if(!build(archive)){
+        return false;
+    }
+    scanCheckpoints(checkpointDir(archiveName));
+    // index still works without its sidecar, it's just made again next time
+    if(!sidecar.open(QIODevice::WriteOnly) || !save(sidecar)){
+        qWarning()<<"cannot write index"<<sidecar.fileName();
+    }
+    return true;
+}
+
+QString ArchiveIndex::checkpointDir(const QString &archiveName)
+{
+    return archiveName + ".ckpt";
+}
+
+void ArchiveIndex::scanCheckpoints(const QString &dir)
+{
+    const QFileInfoList files = QDir(dir).entryInfoList(QStringList() << "*.ckpt",
+                                                        QDir::Files);
+    for(const QFileInfo &info: files){
+        bool ok = false;
+        const int pack = packAtOffset(info.completeBaseName().toLongLong(&ok));
+        if(!ok || pack < 0){
+            continue;
+        }
+        const Checkpoint *known = checkpointBefore(pack);
+        if(known && known->pack == pack){
+            continue;
+        }
+        addCheckpoint(pack, info.absoluteFilePath());
+    }
+}
+
+QString ArchiveIndex::sidecarName(const QString &archiveName)
+{
+    return archiveName + ".idx";
+}
+
+int ArchiveIndex::count() const
+{
+    return entries_.count();
+}
+
+const ArchiveIndex::Entry& ArchiveIndex::entry(int pack) const
+{
+    return entries_.at(pack);
+}
+
+qint64 ArchiveIndex::offset(int pack) const
+{
+    return pack < entries_.count() ? entries_.at(pack).offset : archive_size_;
+}
+
+int ArchiveIndex::packAtOffset(qint64 offset) const
+{
+    if(offset == archive_size_){
+        return entries_.count();
+    }
+    auto it = std::lower_bound(entries_.constBegin(), entries_.constEnd(), offset,
+                               [](const Entry &e, qint64 offset){
+        return e.offset < offset;
+    });
+    if(it == entries_.constEnd() || it->offset != offset){
+        return -1;
+    }
+    return int(it - entries_.constBegin());
+}
+
+qint64 ArchiveIndex::archiveSize() const
+{
+    return archive_size_;
+}
+
+quint64 ArchiveIndex::totalPoints() const
+{
+    return entries_.isEmpty() ? 0 : entries_.last().points;
+}
+
+int ArchiveIndex::packAt(qreal fraction) const
+{
+    if(fraction <= 0){
+        return 0;
+    }
+    if(fraction >= 1){
+        return entries_.count();
+    }
+    const quint64 target = qCeil(totalPoints() * fraction);
+    auto it = std::lower_bound(entries_.constBegin(), entries_.constEnd(), target,
+                               [](const Entry &e, quint64 points){
+        return e.points < points;
+    });
+    // the pack reaching target is painted too
+    return qMin(int(it - entries_.constBegin()) + 1, entries_.count());
+}
+
+int ArchiveIndex::position(const QString &text) const
+{
+    bool ok = false;
+    if(text.endsWith('%')){
+        const qreal percent = text.left(text.length() - 1).toDouble(&ok);
+        return ok && percent >= 0 && percent <= 100 ? packAt(percent / 100) : -1;
+    }
+    const int pack = text.toInt(&ok);
+    return ok && pack >= 0 && pack <= entries_.count() ? pack : -1;
+}
+
+void ArchiveIndex::addCheckpoint(int pack, const QString &file)
+{
+    checkpoints_.append(Checkpoint{pack, file});
+    std::sort(checkpoints_.begin(), checkpoints_.end(),
+              [](const Checkpoint &a, const Checkpoint &b){
+        return a.pack < b.pack;
+    });
+}
+
+const QVector<ArchiveIndex::Checkpoint>& ArchiveIndex::checkpoints() const
+{
+    return checkpoints_;
+}
+
+const ArchiveIndex::Checkpoint* ArchiveIndex::checkpointBefore(int pack) const
+{
+    const Checkpoint *found = nullptr;
+    for(const Checkpoint &c: checkpoints_){
+        if(c.pack > pack){
+            break;
+        }
+        found = &c;
+    }
+    return found;
+}
@@ -0,0 +1,76 @@
+#ifndef ARCHIVEINDEX_H
+#define ARCHIVEINDEX_H
+
+#include <QVector>
+#include <QString>
+#include "packparser.h"
+
+class QIODevice;
+
+/*
+ * ArchiveIndex lists every non-empty pack of an archive: where it
+ * starts, its type, and how many stroke points are painted once it's
+ * replayed. "Pack N" always means the N-th entry, counting from 0.
+ *
+ * It's made in one scan of the archive and kept next to it in a
+ * sidecar file, see sidecarName(). Checkpoints are canvas states saved
+ * elsewhere, the index only remembers before which pack they were taken.
+ *
+ * Sidecar is a QDataStream of
+ *  magic "PIDX", version, archive size, entry count, entries
+ *  (offset, size, type, points), checkpoint count, checkpoints (pack, file).
+ */
+class ArchiveIndex
+{
+public:
+    struct Entry
+    {
+        qint64 offset;      // of size field
+        quint32 size;
+        PackParser::PACK_TYPE type;
+        quint64 points;     // painted up to and including this pack
+    };
+
+    struct Checkpoint
+    {
+        int pack;           // state right before this pack
+        QString file;
+    };
+
+    ArchiveIndex();
+    bool build(QIODevice &archive);
+    bool save(QIODevice &device) const;
+    bool load(QIODevice &device);
+    // sidecar is loaded, or built and saved if it's missing or stale,
+    // then checkpoints are taken from checkpointDir()
+    bool open(const QString &archiveName);
+    static QString sidecarName(const QString &archiveName);
+    static QString checkpointDir(const QString &archiveName);
+    // adds every <offset>.ckpt in dir whose offset starts a pack
+    void scanCheckpoints(const QString &dir);
+
+    int count() const;
+    const Entry& entry(int pack) const;
+    // where pack starts, archive size if pack is count()
+    qint64 offset(int pack) const;
+    // pack starting at offset, count() for archive size, -1 if none
+    int packAtOffset(qint64 offset) const;
+    qint64 archiveSize() const;
+    quint64 totalPoints() const;
+    // positions are counts of packs replayed, i.e. the pack to stop at
+    // number of packs that paint fraction of all points
+    int packAt(qreal fraction) const;
+    // "N" packs or "P%" of points, -1 if it's neither or out of range
+    int position(const QString &text) const;
+
+    void addCheckpoint(int pack, const QString &file);
+    const QVector<Checkpoint>& checkpoints() const;
+    // latest checkpoint taken at or before pack, nullptr if none
+    const Checkpoint* checkpointBefore(int pack) const;
+private:
+    qint64 archive_size_;
+    QVector<Entry> entries_;
+    QVector<Checkpoint> checkpoints_;
+};
+
+#endif // ARCHIVEINDEX_H
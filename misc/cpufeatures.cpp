@@ -0,0 +1,42 @@
+#include "cpufeatures.h"
+
+#include <QtGlobal>
+
+#if defined(Q_PROCESSOR_X86) && defined(Q_CC_MSVC)
+#include <intrin.h>
+#include <immintrin.h>
+#endif
+
+bool CpuFeatures::hasSse2()
+{
+#if defined(Q_PROCESSOR_X86) && defined(Q_CC_GNU)
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse2");
+#elif defined(Q_PROCESSOR_X86) && defined(Q_CC_MSVC)
+    int info[4];
+    __cpuid(info, 1);
+    return info[3] & (1 << 26);
+#else
+    return false;
+#endif
+}
+
+bool CpuFeatures::hasAvx2()
+{
+#if defined(Q_PROCESSOR_X86) && defined(Q_CC_GNU)
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+#elif defined(Q_PROCESSOR_X86) && defined(Q_CC_MSVC)
+    int info[4];
+    __cpuid(info, 1);
+    // avx state must be enabled by OS, too
+    const bool osxsave = info[2] & (1 << 27);
+    if(!osxsave || (_xgetbv(0) & 0x6) != 0x6){
+        return false;
+    }
+    __cpuidex(info, 7, 0);
+    return info[1] & (1 << 5);
+#else
+    return false;
+#endif
+}
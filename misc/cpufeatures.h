@@ -0,0 +1,10 @@
+#ifndef CPUFEATURES_H
+#define CPUFEATURES_H
+
+// Runtime checks for the SIMD kernels, false on non x86 builds
+namespace CpuFeatures {
+bool hasSse2();
+bool hasAvx2();
+}
+
+#endif // CPUFEATURES_H
@@ -2,13 +2,66 @@
 
 #include <QImage>
 #include <QColor>
+#include <QPainter>
+#include <QThreadPool>
+#include <QRunnable>
+#include <QSemaphore>
+#include <QDataStream>
+#include <QDebug>
+#include <cstring>
+
+#include "../brush/dabcompositor.h"
+
+static inline int floor_div(int v, int d)
+{
+    return v >= 0 ? v / d : -((-v + d - 1) / d);
+}
+
+static bool is_transparent(const QImage &tile)
+{
+    for(int y=0;y<tile.height();++y){
+        const quint32 *line = (const quint32*)tile.constScanLine(y);
+        for(int x=0;x<tile.width();++x){
+            if(line[x]){
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// below this many dabs, waking bands costs more than it saves
+static const int MIN_BANDED_DABS = 16;
+
+static int band_threads = 1;
+
+class DabBandTask : public QRunnable
+{
+public:
+    DabBandTask(Layer *layer, const QVector<Layer::Dab> &dabs,
+                int top, int bottom, QSemaphore *done)
+        :layer_(layer), dabs_(dabs), top_(top), bottom_(bottom), done_(done)
+    {
+    }
+    void run()
+    {
+        layer_->blendTileRows(dabs_, top_, bottom_);
+        done_->release();
+    }
+private:
+    Layer *layer_;
+    const QVector<Layer::Dab> &dabs_;
+    int top_;
+    int bottom_;
+    QSemaphore *done_;
+};
 
 Layer::Layer(const QString &name, const QSize &size)
     :lock_(false),
       hide_(false),
       select_(false),
-      touched_(false),
       access_(true),
+      dabs_(0),
       name_(name),
       size_(size)
 {
@@ -16,14 +69,17 @@ Layer::Layer(const QString &name, const QSize &size)
 
 Layer::~Layer()
 {
-    img_.clear();
+    tiles_.clear();
+}
+
+QSize Layer::size() const
+{
+    return size_;
 }
 
-void Layer::create()
+QRect Layer::rect() const
 {
-    img_ = QSharedPointer<QImage>(new QImage(size_, QImage::Format_ARGB32_Premultiplied));
-    img_->fill(Qt::transparent);
-    touched_ = true;
+    return QRect(QPoint(0, 0), size_);
 }
 
 bool Layer::isLocked() const
@@ -43,7 +99,7 @@ bool Layer::isSelected() const
 
 bool Layer::isTouched() const
 {
-    return touched_;
+    return !tiles_.isEmpty();
 }
 
 void Layer::lock()
@@ -58,11 +114,17 @@ void Layer::unlock()
 
 void Layer::hide()
 {
+    if(!hide_){
+        markDirty(rect());
+    }
     hide_ = true;
 }
 
 void Layer::show()
 {
+    if(hide_){
+        markDirty(rect());
+    }
     hide_ = false;
 }
 
@@ -78,36 +140,323 @@ void Layer::deselect()
 
 void Layer::clear()
 {
-    img_.clear();
-    touched_ = false;
+    for(auto it = tiles_.constBegin();it != tiles_.constEnd();++it){
+        dirty_.insert(it.key());
+    }
+    tiles_.clear();
+}
+
+QImage* Layer::tile(int tx, int ty, bool create)
+{
+    const quint32 key = tileKey(tx, ty);
+    auto it = tiles_.find(key);
+    if(it != tiles_.end()){
+        return &it.value();
+    }
+    if(!create){
+        return nullptr;
+    }
+    QImage t(TILE_SIZE, TILE_SIZE, QImage::Format_ARGB32_Premultiplied);
+    t.fill(Qt::transparent);
+    return &tiles_.insert(key, t).value();
+}
+
+const QImage* Layer::constTile(int tx, int ty) const
+{
+    auto it = tiles_.constFind(tileKey(tx, ty));
+    if(it == tiles_.constEnd()){
+        return nullptr;
+    }
+    return &it.value();
+}
+
+QList<QPoint> Layer::tiles() const
+{
+    QList<QPoint> list;
+    for(auto it = tiles_.constBegin();it != tiles_.constEnd();++it){
+        list.append(tileFromKey(it.key()));
+    }
+    return list;
+}
+
+int Layer::tileCount() const
+{
+    return tiles_.count();
+}
+
+QRect Layer::tileRect(int tx, int ty)
+{
+    return QRect(tx * TILE_SIZE, ty * TILE_SIZE, TILE_SIZE, TILE_SIZE);
+}
+
+quint32 Layer::tileKey(int tx, int ty)
+{
+    return (quint32(ty) << 16) | quint32(tx);
+}
+
+QPoint Layer::tileFromKey(quint32 key)
+{
+    return QPoint(key & 0xffff, key >> 16);
+}
+
+QRect Layer::tileSpan(const QRect &rect)
+{
+    if(rect.isEmpty()){
+        return QRect();
+    }
+    const int left = floor_div(rect.left(), TILE_SIZE);
+    const int top = floor_div(rect.top(), TILE_SIZE);
+    const int right = floor_div(rect.right(), TILE_SIZE);
+    const int bottom = floor_div(rect.bottom(), TILE_SIZE);
+    return QRect(QPoint(left, top), QPoint(right, bottom));
+}
+
+void Layer::blendDab(const QImage &dab, const QPoint &pos)
+{
+    const QRect area = QRect(pos, dab.size()) & rect();
+    const QRect span = tileSpan(area);
+    dabs_.fetchAndAddRelaxed(1);
+    for(int ty=span.top();ty<=span.bottom();++ty){
+        for(int tx=span.left();tx<=span.right();++tx){
+            DabCompositor::blend(tile(tx, ty, true), dab,
+                                 pos - QPoint(tx * TILE_SIZE, ty * TILE_SIZE));
+            dirty_.insert(tileKey(tx, ty));
+        }
+    }
+}
+
+void Layer::blendDabs(const QVector<Dab> &dabs)
+{
+    // every tile is made up front, so bands only look tiles up
+    QRect rows;
+    for(const Dab &dab: dabs){
+        const QRect span = tileSpan(QRect(dab.pos, dab.image.size()) & rect());
+        for(int ty=span.top();ty<=span.bottom();++ty){
+            for(int tx=span.left();tx<=span.right();++tx){
+                tile(tx, ty, true);
+                dirty_.insert(tileKey(tx, ty));
+            }
+        }
+        rows |= span;
+    }
+    dabs_.fetchAndAddRelaxed(dabs.count());
+    if(rows.isEmpty()){
+        return;
+    }
+
+    // band i is tile rows [band_top(i), band_top(i+1)), each tile is
+    // in one band only and gets its dabs in stroke order
+    const int bands = dabs.count() < MIN_BANDED_DABS ? 1
+                                                     : qBound(1, band_threads, rows.height());
+    auto band_top = [&rows, bands](int i) {
+        return rows.top() + rows.height() * i / bands;
+    };
+    QSemaphore done;
+    for(int i=1;i<bands;++i){
+        QThreadPool::globalInstance()->start(
+                    new DabBandTask(this, dabs, band_top(i), band_top(i + 1), &done));
+    }
+    blendTileRows(dabs, band_top(0), band_top(1));
+    done.acquire(bands - 1);
+}
+
+void Layer::blendTileRows(const QVector<Dab> &dabs, int top, int bottom)
+{
+    for(const Dab &dab: dabs){
+        const QRect span = tileSpan(QRect(dab.pos, dab.image.size()) & rect());
+        const int first = qMax(top, span.top());
+        const int last = qMin(bottom - 1, span.bottom());
+        for(int ty=first;ty<=last;++ty){
+            for(int tx=span.left();tx<=span.right();++tx){
+                DabCompositor::blend(tile(tx, ty), dab.image,
+                                     dab.pos - QPoint(tx * TILE_SIZE, ty * TILE_SIZE));
+            }
+        }
+    }
+}
+
+void Layer::setBandThreads(int threads)
+{
+    band_threads = qMax(1, threads);
 }
 
-QImage* Layer::imagePtr()
+int Layer::bandThreads()
 {
-    if(!touched_){
-        create();
+    return band_threads;
+}
+
+void Layer::paint(const QRect &rect,
+                  const std::function<void (QPainter *)> &func,
+                  bool mayClear)
+{
+    const QRect span = tileSpan(rect & this->rect());
+    dabs_.fetchAndAddRelaxed(1);
+    for(int ty=span.top();ty<=span.bottom();++ty){
+        for(int tx=span.left();tx<=span.right();++tx){
+            // nothing to erase on a tile that doesn't exist
+            QImage *t = tile(tx, ty, !mayClear);
+            if(!t){
+                continue;
+            }
+            QPainter painter(t);
+            painter.translate(-tx * TILE_SIZE, -ty * TILE_SIZE);
+            func(&painter);
+            dirty_.insert(tileKey(tx, ty));
+        }
+    }
+    if(mayClear){
+        dropEmptyTiles(span);
     }
-    return img_.data();
 }
 
-const QImage* Layer::imageConstPtr()
+void Layer::dropEmptyTiles(const QRect &span)
 {
-    if(!touched_){
-        create();
+    for(int ty=span.top();ty<=span.bottom();++ty){
+        for(int tx=span.left();tx<=span.right();++tx){
+            const quint32 key = tileKey(tx, ty);
+            auto it = tiles_.find(key);
+            if(it != tiles_.end() && is_transparent(it.value())){
+                tiles_.erase(it);
+            }
+        }
+    }
+}
+
+QImage Layer::copy(const QRect &rect) const
+{
+    QImage result(rect.size(), QImage::Format_ARGB32_Premultiplied);
+    result.fill(Qt::transparent);
+    QPainter painter(&result);
+    painter.setCompositionMode(QPainter::CompositionMode_Source);
+    painter.translate(-rect.topLeft());
+    drawOnto(&painter, rect);
+    return result;
+}
+
+// tiles are taken from image, transparent ones are skipped
+void Layer::fromImage(const QImage &image)
+{
+    clear();
+    markDirty(rect());
+    const QImage source = image.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+    const QRect span = tileSpan(source.rect() & rect());
+    for(int ty=span.top();ty<=span.bottom();++ty){
+        for(int tx=span.left();tx<=span.right();++tx){
+            QImage t(TILE_SIZE, TILE_SIZE, QImage::Format_ARGB32_Premultiplied);
+            t.fill(Qt::transparent);
+            QPainter painter(&t);
+            painter.setCompositionMode(QPainter::CompositionMode_Source);
+            painter.drawImage(-tx * TILE_SIZE, -ty * TILE_SIZE, source);
+            painter.end();
+            if(!is_transparent(t)){
+                tiles_.insert(tileKey(tx, ty), t);
+            }
+        }
+    }
+}
+
+void Layer::drawOnto(QPainter *painter, const QRect &rect) const
+{
+    // tiles on right and bottom edges may reach out of layer
+    const QRect clip = rect & this->rect();
+    const QRect span = tileSpan(clip);
+    // walk whichever is smaller, the tiles we have or the span
+    if(tiles_.count() < span.width() * span.height()){
+        for(auto it = tiles_.constBegin();it != tiles_.constEnd();++it){
+            const QPoint origin = tileFromKey(it.key()) * TILE_SIZE;
+            const QRect target = QRect(origin, it.value().size()) & clip;
+            if(!target.isEmpty()){
+                painter->drawImage(target, it.value(),
+                                   target.translated(-origin));
+            }
+        }
+        return;
+    }
+    for(int ty=span.top();ty<=span.bottom();++ty){
+        for(int tx=span.left();tx<=span.right();++tx){
+            const QImage *t = constTile(tx, ty);
+            if(!t){
+                continue;
+            }
+            const QRect target = tileRect(tx, ty) & clip;
+            painter->drawImage(target, *t,
+                               target.translated(-tx * TILE_SIZE, -ty * TILE_SIZE));
+        }
     }
-    return img_.data();
 }
 
 void Layer::resize(const QSize &size)
 {
+    if(size_ == size){
+        return;
+    }
+    if(tiles_.isEmpty()){
+        size_ = size;
+        return;
+    }
+    QImage old(size_, QImage::Format_ARGB32_Premultiplied);
+    old.fill(Qt::transparent);
+    QPainter painter(&old);
+    drawOnto(&painter, rect());
+    painter.end();
     size_ = size;
-    if(!img_.isNull()){
-        if (img_->size() == size)
-            return;
-        *img_ = img_->scaled(size, Qt::KeepAspectRatio);
+    fromImage(old.scaled(size, Qt::KeepAspectRatio));
+}
+
+void Layer::save(QDataStream &out) const
+{
+    out<<hide_<<lock_<<qint32(tiles_.count());
+    for(auto it = tiles_.constBegin();it != tiles_.constEnd();++it){
+        const QImage &t = it.value();
+        // level 1, checkpoints are written often and read rarely
+        out<<it.key()<<qCompress(t.constBits(), t.byteCount(), 1);
     }
 }
 
+bool Layer::load(QDataStream &in)
+{
+    clear();
+    qint32 count;
+    in>>hide_>>lock_>>count;
+    for(int i=0;i<count && in.status() == QDataStream::Ok;++i){
+        quint32 key;
+        QByteArray data;
+        in>>key>>data;
+        data = qUncompress(data);
+        QImage t(TILE_SIZE, TILE_SIZE, QImage::Format_ARGB32_Premultiplied);
+        if(data.size() != t.byteCount()){
+            qWarning()<<"bad tile in checkpoint";
+            return false;
+        }
+        memcpy(t.bits(), data.constData(), data.size());
+        tiles_.insert(key, t);
+    }
+    markDirty(rect());
+    return in.status() == QDataStream::Ok;
+}
+
+QSet<quint32> Layer::takeDirtyTiles()
+{
+    QSet<quint32> dirty;
+    dirty.swap(dirty_);
+    return dirty;
+}
+
+void Layer::markDirty(const QRect &rect)
+{
+    const QRect span = tileSpan(rect & this->rect());
+    for(int ty=span.top();ty<=span.bottom();++ty){
+        for(int tx=span.left();tx<=span.right();++tx){
+            dirty_.insert(tileKey(tx, ty));
+        }
+    }
+}
+
+quint64 Layer::takeDabCount()
+{
+    return dabs_.fetchAndStoreRelaxed(0);
+}
+
 QString Layer::name() const
 {
     return name_;
@@ -3,16 +3,39 @@
 
 #include <QSharedPointer>
 #include <QSize>
+#include <QRect>
+#include <QHash>
+#include <QSet>
+#include <QList>
+#include <QPoint>
+#include <QImage>
+#include <QVector>
+#include <QAtomicInt>
+#include <functional>
 
-class QImage;
+class QPainter;
+class QDataStream;
 
+/*
+ * Layer stores its pixels in TILE_SIZE*TILE_SIZE premultiplied tiles,
+ * which are made on first write. A transparent tile is simply missing,
+ * so memory grows with painted area instead of canvas size.
+ */
 class Layer
 {
 public:
+    static const int TILE_SIZE = 64;
+
+    struct Dab
+    {
+        QImage image;
+        QPoint pos;
+    };
+
     Layer(const QString &name, const QSize &size);
     ~Layer();
-    QImage* imagePtr();
-    const QImage* imageConstPtr();
+    QSize size() const;
+    QRect rect() const;
     void resize(const QSize &size);
     bool isLocked() const;
     bool isHided() const;
@@ -27,17 +50,59 @@ public:
     void clear();
     QString name() const;
     void rename(const QString &new_name);
+
+    // tile at tile coordinates, nullptr if it's transparent and create is false
+    QImage* tile(int tx, int ty, bool create = false);
+    const QImage* constTile(int tx, int ty) const;
+    QList<QPoint> tiles() const;
+    int tileCount() const;
+    static QRect tileRect(int tx, int ty);
+    static quint32 tileKey(int tx, int ty);
+    static QPoint tileFromKey(quint32 key);
+    // tile coordinates of every tile rect touches
+    static QRect tileSpan(const QRect &rect);
+
+    // source-over a premultiplied dab at pos
+    void blendDab(const QImage &dab, const QPoint &pos);
+    // same as blending each dab in turn, but rows of tiles are split in
+    // bandThreads() bands that blend their part of every dab at once
+    void blendDabs(const QVector<Dab> &dabs);
+    // process wide, 1 blends dabs in calling thread
+    static void setBandThreads(int threads);
+    static int bandThreads();
+    // func is called with a painter for each tile in rect, already
+    // translated to layer coordinates; set mayClear if func can erase
+    void paint(const QRect &rect,
+               const std::function<void (QPainter*)> &func,
+               bool mayClear = false);
+    QImage copy(const QRect &rect) const;
+    void fromImage(const QImage &image);
+    void drawOnto(QPainter *painter, const QRect &rect) const;
+
+    // flags and every tile, each one compressed on its own;
+    // load() marks whole layer dirty
+    void save(QDataStream &out) const;
+    bool load(QDataStream &in);
+
+    // tiles changed since last call, as tileKey()s
+    QSet<quint32> takeDirtyTiles();
+    void markDirty(const QRect &rect);
+    // dabs and painter calls since last call
+    quint64 takeDabCount();
 private:
     Q_DISABLE_COPY(Layer)
     bool lock_;
     bool hide_;
     bool select_;
-    bool touched_;  // if pixmap is already created
     bool access_;   //reserved
-    QSharedPointer<QImage> img_;
+    QHash<quint32, QImage> tiles_;
+    QSet<quint32> dirty_;
+    QAtomicInt dabs_;  // counted on painting thread, taken on engine's
     QString name_;
     QSize size_;
-    void create();
+    void dropEmptyTiles(const QRect &span);
+    void blendTileRows(const QVector<Dab> &dabs, int top, int bottom);
+    friend class DabBandTask;
 };
 
 typedef QSharedPointer<Layer> LayerPointer;
@@ -3,10 +3,12 @@
 #include <QPixmap>
 #include <QPainter>
 #include <QDebug>
+#include <algorithm>
 
 LayerManager::LayerManager(const QSize &initSize)
     :lastSelected(0),
-      layerSize_(initSize)
+      layerSize_(initSize),
+      all_dirty_(true)
 {
 }
 
@@ -82,6 +84,7 @@ void LayerManager::insertLayer(LayerPointer image, const QString &name, int pos)
 {
     layerLinks.insert(pos,name);
     layers.insert(name,image);
+    markAllDirty();
     qDebug()<<"instert"<<name<<"at"<<pos;
 }
 
@@ -92,6 +95,7 @@ void LayerManager::appendLayer(LayerPointer image, const QString &name)
     }
     layerLinks.append(name);
     layers.insert(name,image);
+    markAllDirty();
     qDebug()<<"append"<<name<<"at"<<(layerLinks.count()-1);
 }
 
@@ -117,6 +121,7 @@ void LayerManager::removeLayer(const QString &name)
     }
     layers.remove(name);
     layerLinks.removeAll(name);
+    markAllDirty();
     qDebug()<<"remove"<<name;
 }
 
@@ -181,6 +186,7 @@ void LayerManager::resizeLayers(const QSize &newsize)
     for(int i=0;i<layerLinks.count();++i){
         layers[layerLinks[i]]->resize(layerSize_);
     }
+    markAllDirty();
     qDebug()<<"LayerManager::resizeLayers:"<<layerSize_;
 }
 
@@ -190,17 +196,66 @@ void LayerManager::combineLayers(QImage *p, const QRect &rect)
     p->fill(Qt::white);
     QPainter painter(p);
     int lc = this->count();
-    QImage * im = 0;
     for(int i=0;i<lc;++i){
         LayerPointer l = layerFrom(i);
         if( l->isHided() || !l->isTouched() ){
             continue;
         }
-        im = l->imagePtr();
-        if(rect.isNull()){
-            painter.drawImage(0, 0, *im);
-        }else{
-            painter.drawImage(QRectF(rect), *im, QRectF(rect));
+        l->drawOnto(&painter, rect.isNull() ? p->rect() : rect);
+    }
+}
+
+quint64 LayerManager::takeDabCount()
+{
+    quint64 dabs = 0;
+    for(auto &item: layers.values()){
+        dabs += item->takeDabCount();
+    }
+    return dabs;
+}
+
+void LayerManager::markAllDirty()
+{
+    all_dirty_ = true;
+}
+
+QVector<QRect> LayerManager::takeDirtyRects()
+{
+    QSet<quint32> dirty;
+    for(auto &item: layers.values()){
+        dirty.unite(item->takeDirtyTiles());
+    }
+    QVector<QRect> rects;
+    const QRect bound(QPoint(0, 0), layerSize_);
+    if(all_dirty_){
+        all_dirty_ = false;
+        rects.append(bound);
+        return rects;
+    }
+    if(dirty.isEmpty()){
+        return rects;
+    }
+
+    // keys sort row by row, so runs of neighbour tiles merge into one rect
+    QVector<quint32> keys;
+    keys.reserve(dirty.count());
+    for(quint32 key: dirty){
+        keys.append(key);
+    }
+    std::sort(keys.begin(), keys.end());
+    int i = 0;
+    while(i < keys.count()){
+        const QPoint first = Layer::tileFromKey(keys[i]);
+        int j = i + 1;
+        while(j < keys.count() && keys[j] == keys[j-1] + 1){
+            ++j;
         }
+        const QRect run(first.x() * Layer::TILE_SIZE,
+                        first.y() * Layer::TILE_SIZE,
+                        (j - i) * Layer::TILE_SIZE,
+                        Layer::TILE_SIZE);
+        rects.append(run & bound);
+        i = j;
     }
+    return rects;
 }
@@ -5,6 +5,7 @@
 #include <QHash>
 #include <QSize>
 #include <QRect>
+#include <QVector>
 #include "layer.h"
 
 class QString;
@@ -39,6 +40,10 @@ public:
     void resizeLayers(const QSize &newsize);
     void updateSelected();
     void combineLayers(QImage *p, const QRect &rect = QRect());
+    // area whose composite changed since last call, merged from every layer
+    QVector<QRect> takeDirtyRects();
+    void markAllDirty();
+    quint64 takeDabCount();
 
 private:
     Q_DISABLE_COPY(LayerManager)
@@ -48,6 +53,7 @@ private:
     QHash<QString, LayerPointer> layers;
     LayerPointer lastSelected;
     QSize layerSize_;
+    bool all_dirty_;
 
 };
 
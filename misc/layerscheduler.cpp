@@ -0,0 +1,143 @@
+#include "layerscheduler.h"
+
+#include <QThread>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QWaitCondition>
+#include <QQueue>
+
+struct LaneTask
+{
+    std::function<void ()> func;
+    // run after this ticket of that lane is done, unless null
+    SchedulerLane *after;
+    quint64 ticket;
+};
+
+class SchedulerLane : public QThread
+{
+public:
+    SchedulerLane()
+        :submitted_(0),
+          done_(0),
+          stopping_(false)
+    {
+    }
+
+    // returns the task's ticket
+    quint64 push(const LaneTask &task)
+    {
+        QMutexLocker locker(&mutex_);
+        queue_.enqueue(task);
+        not_empty_.wakeOne();
+        return ++submitted_;
+    }
+
+    quint64 submitted() const
+    {
+        QMutexLocker locker(&mutex_);
+        return submitted_;
+    }
+
+    void waitFor(quint64 ticket)
+    {
+        QMutexLocker locker(&mutex_);
+        while(done_ < ticket){
+            progressed_.wait(&mutex_);
+        }
+    }
+
+    // runs what is left in queue, then returns
+    void stop()
+    {
+        {
+            QMutexLocker locker(&mutex_);
+            stopping_ = true;
+            not_empty_.wakeOne();
+        }
+        wait();
+    }
+protected:
+    void run()
+    {
+        forever{
+            LaneTask task;
+            {
+                QMutexLocker locker(&mutex_);
+                while(queue_.isEmpty() && !stopping_){
+                    not_empty_.wait(&mutex_);
+                }
+                if(queue_.isEmpty()){
+                    return;
+                }
+                task = queue_.dequeue();
+            }
+            if(task.after){
+                task.after->waitFor(task.ticket);
+            }
+            task.func();
+            QMutexLocker locker(&mutex_);
+            ++done_;
+            progressed_.wakeAll();
+        }
+    }
+private:
+    mutable QMutex mutex_;
+    QWaitCondition not_empty_;
+    QWaitCondition progressed_;
+    QQueue<LaneTask> queue_;
+    quint64 submitted_;
+    quint64 done_;
+    bool stopping_;
+};
+
+LayerScheduler::LayerScheduler(int lanes)
+    :next_lane_(0)
+{
+    for(int i=0;i<qMax(1, lanes);++i){
+        SchedulerLane *lane = new SchedulerLane;
+        lane->start();
+        lanes_.append(lane);
+    }
+}
+
+LayerScheduler::~LayerScheduler()
+{
+    for(SchedulerLane *lane: lanes_){
+        lane->stop();
+        delete lane;
+    }
+}
+
+int LayerScheduler::laneCount() const
+{
+    return lanes_.count();
+}
+
+void LayerScheduler::submit(const QString &layer, const QString &client,
+                            const std::function<void ()> &task)
+{
+    // new layers are dealt to lanes in turn
+    auto it = layer_lane_.find(layer);
+    if(it == layer_lane_.end()){
+        it = layer_lane_.insert(layer, next_lane_);
+        next_lane_ = (next_lane_ + 1) % lanes_.count();
+    }
+    const int lane = it.value();
+
+    LaneTask t{task, nullptr, 0};
+    auto last = client_last_.constFind(client);
+    if(last != client_last_.constEnd() && last.value().lane != lane){
+        t.after = lanes_[last.value().lane];
+        t.ticket = last.value().number;
+    }
+    const quint64 number = lanes_[lane]->push(t);
+    client_last_[client] = Ticket{lane, number};
+}
+
+void LayerScheduler::barrier()
+{
+    for(SchedulerLane *lane: lanes_){
+        lane->waitFor(lane->submitted());
+    }
+}
@@ -0,0 +1,48 @@
+#ifndef LAYERSCHEDULER_H
+#define LAYERSCHEDULER_H
+
+#include <QString>
+#include <QHash>
+#include <QVector>
+#include <functional>
+
+class SchedulerLane;
+
+/*
+ * LayerScheduler runs painting tasks on laneCount() threads.
+ * Every layer sticks to one lane, so tasks on a layer run in the order
+ * they were submitted, and layers on different lanes paint at the
+ * same time.
+ *
+ * A client's brush keeps state between strokes, so when a client moves
+ * to a layer on another lane, its task waits for the client's previous
+ * one first. Tasks only ever wait on earlier ones, which can't deadlock.
+ *
+ * submit() and barrier() must be called from one thread.
+ */
+class LayerScheduler
+{
+public:
+    explicit LayerScheduler(int lanes);
+    // waits for every task
+    ~LayerScheduler();
+    int laneCount() const;
+    void submit(const QString &layer, const QString &client,
+                const std::function<void ()> &task);
+    // returns once everything submitted so far is done
+    void barrier();
+private:
+    Q_DISABLE_COPY(LayerScheduler)
+    struct Ticket
+    {
+        int lane;
+        quint64 number;
+    };
+
+    QVector<SchedulerLane*> lanes_;
+    QHash<QString, int> layer_lane_;
+    QHash<QString, Ticket> client_last_;
+    int next_lane_;
+};
+
+#endif // LAYERSCHEDULER_H
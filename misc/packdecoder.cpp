@@ -0,0 +1,102 @@
+#include "packdecoder.h"
+
+#include <QRunnable>
+#include <QMutexLocker>
+#include "packparser.h"
+
+// packs in flight per thread, enough to hide uneven pack sizes
+static const int PACKS_PER_THREAD = 16;
+
+class DecodeTask : public QRunnable
+{
+public:
+    DecodeTask(PackDecoder *decoder, quint64 seq, const QByteArray &rawpack)
+        :decoder_(decoder), seq_(seq), rawpack_(rawpack)
+    {
+    }
+    void run()
+    {
+        decoder_->decode(seq_, rawpack_);
+    }
+private:
+    PackDecoder *decoder_;
+    quint64 seq_;
+    QByteArray rawpack_;
+};
+
+PackDecoder::PackDecoder(int threads, DecodeFunc decode)
+    :decode_(decode),
+      slots_(qMax(1, threads) * PACKS_PER_THREAD),
+      submitted_(0),
+      taken_(0)
+{
+    pool_.setMaxThreadCount(qMax(1, threads));
+}
+
+PackDecoder::~PackDecoder()
+{
+    pool_.waitForDone();
+}
+
+int PackDecoder::window() const
+{
+    return slots_.count();
+}
+
+bool PackDecoder::full() const
+{
+    QMutexLocker locker(&mutex_);
+    return submitted_ - taken_ >= quint64(slots_.count());
+}
+
+bool PackDecoder::submit(const QByteArray &rawpack, qint64 pos)
+{
+    QMutexLocker locker(&mutex_);
+    // a slot not taken yet may still hold a stroke
+    if(submitted_ - taken_ >= quint64(slots_.count())){
+        return false;
+    }
+    Slot &slot = slots_[submitted_ % slots_.count()];
+    slot.done = false;
+    slot.ok = false;
+    slot.pos = pos;
+    pool_.start(new DecodeTask(this, submitted_, rawpack));
+    ++submitted_;
+    return true;
+}
+
+bool PackDecoder::next(StrokeBatch &stroke, qint64 &pos)
+{
+    QMutexLocker locker(&mutex_);
+    while(taken_ < submitted_){
+        Slot &slot = slots_[taken_ % slots_.count()];
+        while(!slot.done){
+            ready_.wait(&mutex_);
+        }
+        ++taken_;
+        if(!slot.ok){
+            continue;
+        }
+        stroke = slot.stroke;
+        slot.stroke = StrokeBatch();
+        pos = slot.pos;
+        return true;
+    }
+    return false;
+}
+
+void PackDecoder::decode(quint64 seq, const QByteArray &rawpack)
+{
+    StrokeBatch stroke;
+    PackParser::ParserResult result;
+    const bool ok = PackParser::unpack(rawpack, result)
+            && result.pack_type == PackParser::DATA
+            && decode_(result.pack_data, stroke);
+
+    QMutexLocker locker(&mutex_);
+    Slot &slot = slots_[seq % slots_.count()];
+    slot.ok = ok;
+    slot.stroke = stroke;
+    slot.done = true;
+    ready_.wakeAll();
+}
@@ -0,0 +1,59 @@
+#ifndef PACKDECODER_H
+#define PACKDECODER_H
+
+#include <QByteArray>
+#include <QVector>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QThreadPool>
+#include "strokebatch.h"
+
+/*
+ * PackDecoder inflates and decodes raw packs on a pool of threads, and
+ * hands their strokes back in the order packs were submitted.
+ * At most window() packs are in flight. Room is only made by next(), so
+ * submit() doesn't wait for it and refuses packs while full().
+ *
+ * rawpack is a pack without its size field, it must stay valid until
+ * its stroke is taken, which lets mapped archives go in without a copy.
+ * Packs which are not strokes are dropped quietly.
+ */
+class PackDecoder
+{
+public:
+    // data is an uncompressed DATA pack, must be safe to call from any thread
+    typedef bool (*DecodeFunc)(const QByteArray &data, StrokeBatch &stroke);
+
+    PackDecoder(int threads, DecodeFunc decode);
+    // waits for packs still being decoded
+    ~PackDecoder();
+    int window() const;
+    bool full() const;
+    // pos is handed back with the stroke; false if full()
+    bool submit(const QByteArray &rawpack, qint64 pos);
+    // next stroke in submit order, waiting for it if needed;
+    // false once every submitted pack is taken
+    bool next(StrokeBatch &stroke, qint64 &pos);
+
+    // worker side
+    void decode(quint64 seq, const QByteArray &rawpack);
+private:
+    Q_DISABLE_COPY(PackDecoder)
+    struct Slot
+    {
+        bool done;
+        bool ok;
+        qint64 pos;
+        StrokeBatch stroke;
+    };
+
+    DecodeFunc decode_;
+    QThreadPool pool_;
+    mutable QMutex mutex_;
+    QWaitCondition ready_;
+    QVector<Slot> slots_;   // seq % window()
+    quint64 submitted_;
+    quint64 taken_;
+};
+
+#endif // PACKDECODER_H
@@ -3,14 +3,35 @@
 #include <QJsonObject>
 #include <QDebug>
 #include <QBuffer>
+#include <QFileDevice>
+#include <QMetaMethod>
+#include <zlib.h>
+#include <limits>
 #include "packparser.h"
 
+#ifdef Q_OS_UNIX
+#include <sys/mman.h>
+#endif
+
+// size field of a pack, and payload size in qCompress() format,
+// 4 bytes in big endian
+static quint32 read_size(const uchar *header)
+{
+    return (quint32(header[0]) << 24) | (quint32(header[1]) << 16)
+            | (quint32(header[2]) << 8) | quint32(header[3]);
+}
+
 
 PackParser::PackParser(QObject *parent) :
     QObject(parent),
     device_(nullptr),
     pack_size(0),
-    last_pack_unfinished(false)
+    last_pack_unfinished(false),
+    mapped_file_(nullptr),
+    map_(nullptr),
+    map_size_(0),
+    map_cursor_(0),
+    inflated_size_(0)
 {
     connect(this, &PackParser::newRawPack,
             this, &PackParser::onRawPack);
@@ -18,6 +39,11 @@ PackParser::PackParser(QObject *parent) :
             this, &PackParser::parseContent);
 }
 
+PackParser::~PackParser()
+{
+    unmapFile();
+}
+
 
 void PackParser::onRawData(const QByteArray &rawbytes)
 {
@@ -63,59 +89,241 @@ void PackParser::processRead()
     if(!device_){
         return;
     }
-    if(last_pack_unfinished){
-        if(device_->bytesAvailable() >= pack_size){
-            QByteArray info = device_->read(pack_size);
-            last_pack_unfinished = false;
-            emit newRawPack(info);
-        }else{
-            if(device_->atEnd()){
-                emit parseDone();
-            } else {
-                emit drain();
+    // take every complete pack we have in one go,
+    // rather than coming back through event loop for each of them
+    forever {
+        if(!last_pack_unfinished){
+            if(device_->bytesAvailable() < 4){
+                break;
             }
-            return;
+            uchar header[4];
+            device_->read((char*)header, 4);
+            pack_size = read_size(header);
+            last_pack_unfinished = true;
         }
-    }
-
-    if(device_->bytesAvailable() < 4){
-        if(device_->atEnd()){
-            emit parseDone();
-        } else {
-            emit drain();
+        if(device_->bytesAvailable() < pack_size){
+            break;
         }
-        return;
+        QByteArray info = device_->read(pack_size);
+        last_pack_unfinished = false;
+        emit newRawPack(info);
     }
 
-    // in case we have a lot of data to process
-    //    QCoreApplication::processEvents();
-    char c1, c2, c3, c4;
-    device_->getChar(&c1);
-    device_->getChar(&c2);
-    device_->getChar(&c3);
-    device_->getChar(&c4);
-    pack_size = (uchar(c1) << 24) + (uchar(c2) << 16)
-            + (uchar(c3) << 8) + uchar(c4);
-    last_pack_unfinished = true;
-
-    this->metaObject()->invokeMethod(this, "processRead", Qt::QueuedConnection);
+    if(device_->atEnd()){
+        emit parseDone();
+    } else {
+        emit drain();
+    }
 }
 
 void PackParser::onRawPack(const QByteArray &rawpack)
 {
+    ParserResult result;
+    if(unpack(rawpack, result)){
+        emit newPack(result);
+    }
+}
+
+bool PackParser::unpack(const QByteArray &rawpack, ParserResult &result)
+{
+    if(rawpack.isEmpty()){
+        return false;
+    }
     bool isCompressed = rawpack[0] & 0x1;
     PACK_TYPE pack_type = PACK_TYPE((rawpack[0] & binL<110>::value) >> 0x1);
-    QByteArray data_without_header = rawpack.right(rawpack.length()-1);
     if(isCompressed){
+        // no need to copy payload before it's uncompressed
+        const QByteArray data_without_header =
+                QByteArray::fromRawData(rawpack.constData()+1,
+                                        rawpack.length()-1);
         QByteArray tmp = qUncompress(data_without_header);
         if(tmp.isEmpty()){
             qWarning()<<"bad input"<<data_without_header.toHex();
-            return;
+            return false;
         }
-        emit newPack(ParserResult(pack_type, tmp));
+        result = ParserResult(pack_type, tmp);
     }else{
-        emit newPack(ParserResult(pack_type, data_without_header));
+        result = ParserResult(pack_type, rawpack.mid(1));
+    }
+    return true;
+}
+
+// read next pack from device without event loop, bad packs are skipped
+// returns false when device drains
+bool PackParser::readPack(QIODevice &device, ParserResult &result)
+{
+    QByteArray rawpack;
+    while(readRawPack(device, rawpack)){
+        if(unpack(rawpack, result)){
+            return true;
+        }
+    }
+    return false;
+}
+
+bool PackParser::readRawPack(QIODevice &device, QByteArray &rawpack)
+{
+    uchar header[4];
+    if(device.read((char*)header, 4) != 4){
+        return false;
+    }
+    const quint32 size = read_size(header);
+    rawpack = device.read(size);
+    if(quint32(rawpack.length()) != size){
+        qWarning()<<"truncated pack at"<<device.pos();
+        return false;
     }
+    return true;
+}
+
+// Only size and header byte of each pack are read. Position of device
+// is restored afterwards, returns -1 if device cannot seek.
+qint64 PackParser::countPacks(QIODevice &device, PACK_TYPE type)
+{
+    if(device.isSequential()){
+        return -1;
+    }
+    const qint64 start = device.pos();
+    qint64 count = 0;
+    qint64 pos = start;
+    forever {
+        uchar header[5];
+        if(!device.seek(pos) || device.read((char*)header, 5) != 5){
+            break;
+        }
+        const quint32 size = read_size(header);
+        if(!size){
+            pos += 4;
+            continue;
+        }
+        if(PACK_TYPE((header[4] & binL<110>::value) >> 0x1) == type){
+            ++count;
+        }
+        pos += 4 + size;
+    }
+    device.seek(start);
+    return count;
+}
+
+// Map the whole archive, so that nextPack() can walk packs in place.
+// Returns false if file cannot be mapped, use readPack() then.
+bool PackParser::mapFile(QFileDevice &file)
+{
+    unmapFile();
+    const qint64 size = file.size();
+    if(size <= 0){
+        return false;
+    }
+    uchar* map = file.map(0, size);
+    if(!map){
+        return false;
+    }
+#ifdef Q_OS_UNIX
+    madvise(map, size, MADV_SEQUENTIAL);
+#endif
+    mapped_file_ = &file;
+    map_ = map;
+    map_size_ = size;
+    map_cursor_ = 0;
+    return true;
+}
+
+void PackParser::unmapFile()
+{
+    if(mapped_file_ && map_){
+        mapped_file_->unmap(map_);
+    }
+    mapped_file_ = nullptr;
+    map_ = nullptr;
+    map_size_ = 0;
+    map_cursor_ = 0;
+}
+
+qint64 PackParser::mappedPosition() const
+{
+    return map_cursor_;
+}
+
+void PackParser::setMappedPosition(qint64 offset)
+{
+    map_cursor_ = qBound<qint64>(0, offset, map_size_);
+}
+
+// payload is in qCompress() format: 4 bytes of expected size in big endian,
+// followed by zlib stream
+bool PackParser::inflate(const char *data, int size)
+{
+    if(size < 4){
+        return false;
+    }
+    const uchar* header = (const uchar*)data;
+    const quint32 expected = read_size(header);
+    // expected size comes from the archive, so don't trust it further than
+    // deflate can go, which is about 1032:1
+    const quint64 limit = qMin<quint64>(quint64(size - 4) * 1032 + 64,
+                                        std::numeric_limits<int>::max());
+    if(expected > limit){
+        return false;
+    }
+    if(quint32(inflate_buffer_.size()) < expected){
+        inflate_buffer_.resize(int(expected));
+    }
+    uLongf len = expected;
+    int ret = ::uncompress((Bytef*)inflate_buffer_.data(), &len,
+                           (const Bytef*)data+4, size-4);
+    if(ret != Z_OK){
+        return false;
+    }
+    inflated_size_ = len;
+    return true;
+}
+
+bool PackParser::nextPack(PackView &view)
+{
+    PackView raw;
+    while(nextRawPack(raw)){
+        const bool isCompressed = raw.data[0] & 0x1;
+        view.pack_type = raw.pack_type;
+        view.offset = raw.offset;
+        if(!isCompressed){
+            view.data = raw.data + 1;
+            view.size = raw.size - 1;
+            return true;
+        }
+        if(!inflate(raw.data + 1, raw.size - 1)){
+            qWarning()<<"bad input at"<<raw.offset;
+            continue;
+        }
+        view.data = inflate_buffer_.constData();
+        view.size = inflated_size_;
+        return true;
+    }
+    return false;
+}
+
+// points into the mapping, so view is valid until unmapFile()
+bool PackParser::nextRawPack(PackView &view)
+{
+    while(map_ && map_cursor_ + 4 <= map_size_){
+        const uchar* p = map_ + map_cursor_;
+        const quint32 size = read_size(p);
+        const qint64 offset = map_cursor_;
+        if(offset + 4 + size > map_size_){
+            qWarning()<<"truncated pack at"<<offset;
+            map_cursor_ = map_size_;
+            return false;
+        }
+        map_cursor_ += 4 + size;
+        if(!size){
+            continue;
+        }
+        view.data = (const char*)p + 4;
+        view.size = size;
+        view.pack_type = PACK_TYPE((view.data[0] & binL<110>::value) >> 0x1);
+        view.offset = offset;
+        return true;
+    }
+    return false;
 }
 
 void PackParser::parseContent(const PackParser::ParserResult &result)
@@ -123,6 +331,10 @@ void PackParser::parseContent(const PackParser::ParserResult &result)
     if(result.pack_type != PACK_TYPE::DATA) {
         return;
     }
+    // decoding json is costly, skip it if nobody wants the document
+    if(!isSignalConnected(QMetaMethod::fromSignal(&PackParser::docGenerated))) {
+        return;
+    }
 
     auto doc = QJsonDocument::fromJson(result.pack_data);
     emit docGenerated(doc);
@@ -4,6 +4,8 @@
 #include <QObject>
 #include <QBuffer>
 
+class QFileDevice;
+
 #include "binary.h"
 
 class PackParser : public QObject
@@ -20,7 +22,8 @@ public:
 
     struct ParserResult
     {
-        ParserResult(PACK_TYPE t, const QByteArray& d):
+        ParserResult(PACK_TYPE t = MANAGER,
+                     const QByteArray& d = QByteArray()):
             pack_type(t),
             pack_data(d)
         {
@@ -31,12 +34,39 @@ public:
 
     };
 
+    // A view over one pack of a mapped archive. data points either into
+    // the mapping or into the parser's inflate buffer, so it's only
+    // valid until next nextPack() call.
+    struct PackView
+    {
+        PACK_TYPE pack_type;
+        const char* data;
+        int size;
+        qint64 offset;  // where the pack starts in archive
+    };
+
     explicit PackParser(QObject *parent = 0);
+    ~PackParser();
     QByteArray assamblePack(bool compress,
                             PACK_TYPE pt,
                             const QByteArray& bytes);
     QByteArray packRaw(const QByteArray &content);
-    
+    bool readPack(QIODevice &device, ParserResult &result);
+    // same as above, but pack is left as is, header byte included
+    static bool readRawPack(QIODevice &device, QByteArray &rawpack);
+    bool mapFile(QFileDevice &file);
+    void unmapFile();
+    bool nextPack(PackView &view);
+    // view of next pack as is, header byte included and never inflated
+    bool nextRawPack(PackView &view);
+    // safe to call from any thread
+    static bool unpack(const QByteArray &rawpack, ParserResult &result);
+    qint64 mappedPosition() const;
+    // offset must be where a pack starts
+    void setMappedPosition(qint64 offset);
+    // number of packs of type in device, without reading their content
+    static qint64 countPacks(QIODevice &device, PACK_TYPE type);
+
 signals:
     void newRawPack(const QByteArray& rawpack);
     void newPack(const ParserResult& result);
@@ -52,9 +82,16 @@ public slots:
 protected slots:
     void processRead();
 private:
+    bool inflate(const char *data, int size);
     QIODevice* device_;
     quint32 pack_size;
     bool last_pack_unfinished;
+    QFileDevice* mapped_file_;
+    uchar* map_;
+    qint64 map_size_;
+    qint64 map_cursor_;
+    QByteArray inflate_buffer_;
+    int inflated_size_;
 
 };
 
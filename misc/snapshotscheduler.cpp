@@ -0,0 +1,110 @@
+#include "snapshotscheduler.h"
+
+#include <QString>
+#include <QDebug>
+
+SnapshotScheduler::SnapshotScheduler(Policy policy, qint64 value)
+    :policy_(policy),
+      value_(value),
+      total_blocks_(-1),
+      step_(1),
+      blocks_(0),
+      next_(0),
+      snapshots_(0)
+{
+    updateStep();
+}
+
+void SnapshotScheduler::setPolicy(Policy policy, qint64 value)
+{
+    policy_ = policy;
+    value_ = value;
+    updateStep();
+}
+
+SnapshotScheduler::Policy SnapshotScheduler::policy() const
+{
+    return policy_;
+}
+
+qint64 SnapshotScheduler::value() const
+{
+    return value_;
+}
+
+void SnapshotScheduler::setTotalBlocks(qint64 blocks)
+{
+    total_blocks_ = blocks;
+    if(policy_ == TARGET_FRAMES && blocks < 0){
+        qWarning()<<"block count unknown, snapshot every 20 blocks";
+    }
+    updateStep();
+}
+
+void SnapshotScheduler::reset()
+{
+    blocks_ = 0;
+    next_ = 0;
+    snapshots_ = 0;
+}
+
+void SnapshotScheduler::updateStep()
+{
+    const qint64 value = qMax<qint64>(value_, 1);
+    if(policy_ != TARGET_FRAMES){
+        step_ = value;
+        return;
+    }
+    if(total_blocks_ < 0){
+        step_ = 20;
+        return;
+    }
+    step_ = qMax<qint64>((total_blocks_ + value - 1) / value, 1);
+}
+
+bool SnapshotScheduler::blockDone(quint64 dabs)
+{
+    ++blocks_;
+    quint64 measure = 0;
+    switch(policy_){
+    case EVERY_DABS:
+        measure = dabs;
+        break;
+    case EVERY_MS:
+        measure = blocks_ * BLOCK_INTERVAL;
+        break;
+    default:
+        // block 1, 1+step, 1+2*step...
+        measure = blocks_ - 1;
+        break;
+    }
+    if(measure < next_){
+        return false;
+    }
+    next_ = measure + step_;
+    ++snapshots_;
+    return true;
+}
+
+quint64 SnapshotScheduler::snapshots() const
+{
+    return snapshots_;
+}
+
+bool SnapshotScheduler::policyFromName(const QString &name,
+                                       SnapshotScheduler::Policy *policy)
+{
+    const QString n = name.toLower();
+    if(n == "blocks"){
+        *policy = EVERY_BLOCKS;
+    }else if(n == "dabs"){
+        *policy = EVERY_DABS;
+    }else if(n == "ms"){
+        *policy = EVERY_MS;
+    }else if(n == "frames"){
+        *policy = TARGET_FRAMES;
+    }else{
+        return false;
+    }
+    return true;
+}
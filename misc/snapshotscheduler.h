@@ -0,0 +1,53 @@
+#ifndef SNAPSHOTSCHEDULER_H
+#define SNAPSHOTSCHEDULER_H
+
+#include <QtGlobal>
+
+class QString;
+
+/*
+ * SnapshotScheduler decides after which blocks a snapshot goes to video.
+ * The first block always makes one, next is due once the policy's
+ * measure grew by value() since the last snapshot.
+ *
+ * Archives carry no timestamps, so EVERY_MS counts replay time, i.e.
+ * BLOCK_INTERVAL ms per block, the pace blocks are shown at live.
+ * TARGET_FRAMES spreads value() snapshots evenly over the block count
+ * from setTotalBlocks(), which comes from a pre-scan of the archive.
+ */
+class SnapshotScheduler
+{
+public:
+    enum Policy {
+        EVERY_BLOCKS = 0,
+        EVERY_DABS,
+        EVERY_MS,
+        TARGET_FRAMES
+    };
+    static const int BLOCK_INTERVAL = 10;
+
+    explicit SnapshotScheduler(Policy policy = EVERY_BLOCKS, qint64 value = 20);
+    void setPolicy(Policy policy, qint64 value);
+    Policy policy() const;
+    qint64 value() const;
+    // -1 if unknown
+    void setTotalBlocks(qint64 blocks);
+    void reset();
+
+    // called once a block is painted, dabs is the total painted so far
+    bool blockDone(quint64 dabs);
+    quint64 snapshots() const;
+
+    static bool policyFromName(const QString &name, Policy *policy);
+private:
+    void updateStep();
+    Policy policy_;
+    qint64 value_;
+    qint64 total_blocks_;
+    quint64 step_;
+    quint64 blocks_;
+    quint64 next_;
+    quint64 snapshots_;
+};
+
+#endif // SNAPSHOTSCHEDULER_H
@@ -0,0 +1,112 @@
+#ifndef SPSCRING_H
+#define SPSCRING_H
+
+#include <QtGlobal>
+#include <QAtomicInteger>
+#include <algorithm>
+
+/*
+ * SpscRing is a fixed size lock-free queue for exactly one producer
+ * thread and one consumer thread. Slots are made once, push() copies
+ * into one and pop() swaps items out, so nothing is allocated per item.
+ *
+ * Producer checks claimWakeup() after pushing: it's true once for every
+ * wakeupHandled() of the consumer, so a burst of items costs only one
+ * notification, e.g. one queued signal.
+ */
+template<typename T>
+class SpscRing
+{
+public:
+    // capacity is rounded up to a power of two
+    explicit SpscRing(int capacity = 1024)
+        :head_(0),
+          high_(0),
+          tail_(0),
+          wakeup_(0)
+    {
+        quint32 size = 1;
+        while(size < quint32(qMax(1, capacity))){
+            size <<= 1;
+        }
+        items_ = new T[size];
+        size_ = size;
+    }
+
+    ~SpscRing()
+    {
+        delete [] items_;
+    }
+
+    int capacity() const
+    {
+        return size_;
+    }
+
+    // producer, false if ring is full
+    bool push(const T &item)
+    {
+        const quint32 head = head_.load();
+        const quint32 tail = tail_.loadAcquire();
+        if(head - tail == size_){
+            return false;
+        }
+        items_[head & (size_ - 1)] = item;
+        head_.storeRelease(head + 1);
+        const quint32 depth = head + 1 - tail;
+        if(depth > high_.load()){
+            high_.store(depth);
+        }
+        return true;
+    }
+
+    // consumer, moves up to max items to out, returns how many
+    int pop(T *out, int max)
+    {
+        const quint32 tail = tail_.load();
+        const quint32 head = head_.loadAcquire();
+        const int n = int(qMin<quint32>(head - tail, quint32(qMax(0, max))));
+        for(int i=0;i<n;++i){
+            T &slot = items_[(tail + i) & (size_ - 1)];
+            std::swap(out[i], slot);
+            slot = T();
+        }
+        tail_.storeRelease(tail + n);
+        return n;
+    }
+
+    // items waiting, exact only on consumer's side
+    int depth() const
+    {
+        return int(head_.loadAcquire() - tail_.loadAcquire());
+    }
+
+    // deepest the ring has been, for tuning its capacity
+    int highWatermark() const
+    {
+        return int(high_.load());
+    }
+
+    bool claimWakeup()
+    {
+        return !wakeup_.fetchAndStoreOrdered(1);
+    }
+
+    // before popping, so items pushed meanwhile wake us again
+    void wakeupHandled()
+    {
+        wakeup_.fetchAndStoreOrdered(0);
+    }
+private:
+    Q_DISABLE_COPY(SpscRing)
+    T *items_;
+    quint32 size_;
+    // producer's and consumer's counters on their own cache lines
+    QAtomicInteger<quint32> head_;
+    QAtomicInteger<quint32> high_;
+    char pad_[64];
+    QAtomicInteger<quint32> tail_;
+    QAtomicInteger<quint32> wakeup_;
+};
+
+#endif // SPSCRING_H
@@ -0,0 +1,28 @@
+#ifndef STROKEBATCH_H
+#define STROKEBATCH_H
+
+#include <QString>
+#include <QVector>
+#include <QVariantMap>
+#include <QMetaType>
+
+struct StrokePoint
+{
+    int x;
+    int y;
+    qreal pressure;
+};
+
+// One block of an archive: a continuous stroke drawn by a single client
+// on a single layer with a single brush.
+struct StrokeBatch
+{
+    QString clientid;
+    QString layer;
+    QVariantMap brush;  // brush settings, with its name in "name"
+    QVector<StrokePoint> points;
+};
+
+Q_DECLARE_METATYPE(StrokeBatch)
+
+#endif // STROKEBATCH_H
@@ -0,0 +1,203 @@
+#include "strokecodec.h"
+
+#include <QIODevice>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonArray>
+#include <QJsonValue>
+#include <QtEndian>
+#include <QDebug>
+#include <cstring>
+
+#include "packparser.h"
+
+static const char magic[4] = {'\0', 'S', 'T', 'K'};
+static const quint8 version = 1;
+static const quint8 flag_pressure = 0x1;
+static const int header_size = 18;
+
+template<typename T>
+static inline void append_le(QByteArray &out, T value)
+{
+    char buf[sizeof(T)];
+    qToLittleEndian<T>(value, (uchar*)buf);
+    out.append(buf, sizeof(T));
+}
+
+template<typename T>
+static inline T read_le(const char *p)
+{
+    return qFromLittleEndian<T>((const uchar*)p);
+}
+
+bool StrokeCodec::isRecord(const char *data, int size)
+{
+    return size >= header_size && !memcmp(data, magic, sizeof(magic));
+}
+
+QByteArray StrokeCodec::encode(const StrokeBatch &batch)
+{
+    const QByteArray client = batch.clientid.toUtf8();
+    const QByteArray layer = batch.layer.toUtf8();
+    const QByteArray brush = QJsonDocument(QJsonObject::fromVariantMap(batch.brush))
+            .toJson(QJsonDocument::Compact);
+    const int count = batch.points.count();
+
+    quint8 flags = 0;
+    for(const StrokePoint &p: batch.points){
+        if(p.pressure != 1.0){
+            flags |= flag_pressure;
+            break;
+        }
+    }
+
+    QByteArray out;
+    out.reserve(header_size + client.size() + layer.size() + brush.size()
+                + count * (flags & flag_pressure ? 16 : 8));
+    out.append(magic, sizeof(magic));
+    append_le<quint8>(out, version);
+    append_le<quint8>(out, flags);
+    append_le<quint16>(out, client.size());
+    append_le<quint16>(out, layer.size());
+    append_le<quint32>(out, brush.size());
+    append_le<quint32>(out, count);
+    out.append(client);
+    out.append(layer);
+    out.append(brush);
+    for(const StrokePoint &p: batch.points){
+        append_le<qint32>(out, p.x);
+    }
+    for(const StrokePoint &p: batch.points){
+        append_le<qint32>(out, p.y);
+    }
+    if(flags & flag_pressure){
+        for(const StrokePoint &p: batch.points){
+            quint64 bits;
+            const double pressure = p.pressure;
+            memcpy(&bits, &pressure, sizeof(bits));
+            append_le<quint64>(out, bits);
+        }
+    }
+    return out;
+}
+
+bool StrokeCodec::decode(const char *data, int size, StrokeBatch &batch)
+{
+    if(!isRecord(data, size) || quint8(data[4]) != version){
+        return false;
+    }
+    const quint8 flags = data[5];
+    const int client_len = read_le<quint16>(data + 6);
+    const int layer_len = read_le<quint16>(data + 8);
+    const qint64 brush_len = read_le<quint32>(data + 10);
+    const qint64 count = read_le<quint32>(data + 14);
+    const qint64 point_size = flags & flag_pressure ? 16 : 8;
+    if(header_size + client_len + layer_len + brush_len
+            + count * point_size > size || count < 1){
+        qWarning()<<"bad stroke record";
+        return false;
+    }
+
+    const char *p = data + header_size;
+    batch.clientid = QString::fromUtf8(p, client_len);
+    p += client_len;
+    batch.layer = QString::fromUtf8(p, layer_len);
+    p += layer_len;
+    batch.brush = QJsonDocument::fromJson(QByteArray::fromRawData(p, brush_len))
+            .object().toVariantMap();
+    p += brush_len;
+
+    batch.points.resize(count);
+    StrokePoint *points = batch.points.data();
+    const char *xs = p;
+    const char *ys = xs + count * 4;
+    const char *prs = ys + count * 4;
+    const bool has_pressure = flags & flag_pressure;
+    for(int i=0;i<count;++i){
+        points[i].x = read_le<qint32>(xs + i * 4);
+        points[i].y = read_le<qint32>(ys + i * 4);
+        if(has_pressure){
+            const quint64 bits = read_le<quint64>(prs + i * 8);
+            double pressure;
+            memcpy(&pressure, &bits, sizeof(pressure));
+            points[i].pressure = pressure;
+        }else{
+            points[i].pressure = 1.0;
+        }
+    }
+    return true;
+}
+
+// same rules as json blocks were replayed with,
+// missing coordinates are 0 and missing pressure is 1.0
+bool StrokeCodec::fromBlock(const QJsonObject &block, StrokeBatch &batch)
+{
+    const QJsonArray list = block.value("block").toArray();
+    if(list.isEmpty()){
+        return false;
+    }
+    batch.clientid = block.value("clientid").toString();
+    batch.layer = block.value("layer").toString();
+    batch.brush = block.value("brush").toObject().toVariantMap();
+    batch.points.resize(list.size());
+    StrokePoint *points = batch.points.data();
+    for(int i=0;i<list.size();++i){
+        const QJsonObject point = list.at(i).toObject();
+        points[i].x = qRound(point.value("x").toDouble());
+        points[i].y = qRound(point.value("y").toDouble());
+        const QJsonValue pressure = point.value("pressure");
+        points[i].pressure = pressure.isUndefined() ? 1.0 : pressure.toDouble();
+    }
+    return true;
+}
+
+bool StrokeCodec::fromData(const QByteArray &data, StrokeBatch &batch)
+{
+    if(isRecord(data.constData(), data.size())){
+        return decode(data.constData(), data.size(), batch);
+    }
+    const QJsonObject obj = QJsonDocument::fromJson(data).object();
+    if(obj.value("action").toString().toLower() != "block"){
+        return false;
+    }
+    return fromBlock(obj, batch);
+}
+
+// rewrite every json block in archive as a stroke record, keeping its
+// compress flag; other packs, bad ones included, are copied byte for byte
+bool StrokeCodec::convertArchive(QIODevice &in, QIODevice &out)
+{
+    PackParser parser;
+    PackParser::ParserResult result;
+    StrokeBatch batch;
+    QByteArray rawpack;
+    while(!in.atEnd()){
+        if(!PackParser::readRawPack(in, rawpack)){
+            qWarning()<<"archive ends in the middle of a pack";
+            return false;
+        }
+        QByteArray pack;
+        if(!rawpack.isEmpty()
+                && PackParser::PACK_TYPE((rawpack[0] & binL<110>::value) >> 0x1)
+                == PackParser::DATA
+                && PackParser::unpack(rawpack, result)
+                && !isRecord(result.pack_data.constData(), result.pack_data.size())){
+            const QJsonObject obj = QJsonDocument::fromJson(result.pack_data).object();
+            if(obj.value("action").toString().toLower() == "block"
+                    && fromBlock(obj, batch)){
+                const bool compressed = rawpack[0] & 0x1;
+                pack = parser.packRaw(parser.assamblePack(compressed,
+                                                          PackParser::DATA,
+                                                          encode(batch)));
+            }
+        }
+        if(pack.isEmpty()){
+            pack = parser.packRaw(rawpack);
+        }
+        if(out.write(pack) != pack.length()){
+            qWarning()<<"cannot write converted archive";
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,45 @@
+#ifndef STROKECODEC_H
+#define STROKECODEC_H
+
+#include <QByteArray>
+#include "strokebatch.h"
+
+class QIODevice;
+class QJsonObject;
+
+/*
+ * Binary stroke record, a compact replacement of json blocks.
+ * Everything is little endian:
+ *
+ *  magic       4 bytes, "\0STK"
+ *  version     1 byte
+ *  flags       1 byte, bit 0 set if pressure array presents
+ *  client len  2 bytes
+ *  layer len   2 bytes
+ *  brush len   4 bytes
+ *  count       4 bytes, number of points
+ *  client id   utf-8
+ *  layer name  utf-8
+ *  brush       settings in compact json
+ *  x           int32 * count
+ *  y           int32 * count
+ *  pressure    double * count, only if flag is set
+ *
+ * Records are carried by DATA packs just like json blocks, the leading
+ * zero byte tells them apart since json cannot start with it.
+ */
+class StrokeCodec
+{
+public:
+    static bool isRecord(const char *data, int size);
+    static QByteArray encode(const StrokeBatch &batch);
+    static bool decode(const char *data, int size, StrokeBatch &batch);
+    static bool fromBlock(const QJsonObject &block, StrokeBatch &batch);
+    // DATA pack is either a record or a json object,
+    // returns true if it carries a stroke
+    static bool fromData(const QByteArray &data, StrokeBatch &batch);
+    // false if in is truncated or out cannot be written
+    static bool convertArchive(QIODevice &in, QIODevice &out);
+};
+
+#endif // STROKECODEC_H